@@ -0,0 +1,110 @@
+/*bench_composer.cpp
+ *
+ * Throughput of composer::message::format for typical message shapes. Every
+ * case is run through the output paths of the composer and reports the
+ * messages per second and the allocations per message. The allocations are
+ * counted by replacing the global operator new of the bench runner.
+ *
+ *   benchrunner [messages per case]
+ * */
+
+#include "../composer.hpp"
+#include "../static_composer.hpp"
+
+#include <new>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+    std::size_t allocations = 0; //the bench runs on one thread
+}
+
+void* operator new( std::size_t size )
+{
+    ++allocations;
+    if(void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete( void *p ) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+struct bench_case
+{
+    const char *name;
+    const char *format;
+};
+
+const bench_case cases[] = {
+    {"literals", "#2;HEADER;VERSION 1.0;STATION 0815;\\$START;#13;#10;STATUS OK;PAYLOAD FOLLOWS;"
+        "$(id:%06d);END OF TELEGRAM;#13;#10;#3;"},
+    {"fields", "$(id:%06d);$(name:%-10s);$(value:%+.4d);$(code:%X);$(id);$(name:%.3s);"
+        "$(value:%08d);$(code:%08x);$(name:%20s);$(id:%-8d)"},
+    {"checksum", "#2;$(id:%06d);$(name);$(value:%d);$(code);#3;$checksum(%04X,crc16modbus)"},
+    {"timestamp", "$now(%Y-%m-%d %H:%M:%S.%L);$(id:%d);$(name);$seq(%06d,1,999999)"}
+};
+
+constexpr char static_fields[] = "$(id:%06d);$(name:%-10s);$(value:%+.4d);$(code:%X);$(id);$(name:%.3s);"
+        "$(value:%08d);$(code:%08x);$(name:%20s);$(id:%-8d)";
+
+const composer::value_ref slots[] = {{"4711", 4}, {"max brause", 10}, {"-42", 3}, {"48879", 5}};
+
+//runs f count times and prints the rate and the allocations per call
+template<typename F>
+void measure( const char *name, const char *path, std::size_t count, F f )
+{
+    f(); //warm up buffers and caches
+    auto before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for( std::size_t i = 0; i < count; ++i )
+        f();
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    auto allocated = allocations - before;
+
+    std::printf("%-10s %-8s %14.0f msg/s %8.2f alloc/msg\n", name, path,
+            count / seconds.count(), double(allocated) / count);
+}
+
+}
+
+int main( int args, char *argv[] )
+{
+    std::size_t count = args > 1 ? std::strtoul(argv[1], 0, 10) : 1000000;
+    if(count == 0)
+    {
+        std::fprintf(stderr, "usage: %s [messages per case]\n", argv[0]);
+        return 1;
+    }
+
+    composer::sequence_counters counters;
+    composer::context ctx;
+    ctx.counters(&counters);
+
+    char buffer[512];
+    composer::gather_list gl;
+    std::size_t sink = 0; //keeps the results alive
+
+    for( const auto &c: cases )
+    {
+        auto msg = composer::message(c.name, c.format);
+        auto keys = msg.keys().size();
+
+        measure(c.name, "string", count, [&]{ sink += msg.format(slots, keys, &ctx).size(); });
+        measure(c.name, "buffer", count, [&]{ sink += msg.format(slots, keys, buffer, sizeof(buffer), &ctx); });
+        measure(c.name, "gather", count, [&]{ msg.format(slots, keys, &gl, &ctx); sink += gl.count(); });
+    }
+
+    typedef composer::static_message<static_fields> fields;
+    measure("fields", "static", count, [&]{ sink += fields::format(slots, 4, buffer, sizeof(buffer)); });
+
+    return sink ? 0 : 1;
+}
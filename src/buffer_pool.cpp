@@ -0,0 +1,322 @@
+#include "buffer_pool.hpp"
+
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <utility>
+
+namespace composer
+{
+
+class thread_cache;
+
+//the header of a buffer, the bytes follow it in the same allocation
+struct output_buffer::block
+{
+    std::atomic<std::size_t> refs; //handles on the buffer
+    block *next; //link in a free list or in the remote stack
+    thread_cache *owner; //0 if the buffer is not pooled
+    unsigned size_class;
+    std::size_t capacity, size;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+namespace
+{
+    typedef output_buffer::block block;
+
+    const unsigned size_classes = 11; //64 bytes to 64 KiB
+    const std::size_t smallest = 64;
+    const std::size_t cached_bytes = 256 * 1024; //free bytes kept per class and thread
+
+    unsigned size_class( std::size_t capacity )
+    {
+        unsigned c = 0;
+        while(c < size_classes and (smallest << c) < capacity)
+            ++c;
+        return c;
+    }
+
+    block* allocate( std::size_t capacity, unsigned size_class, thread_cache *owner )
+    {
+        auto *b = new (::operator new(sizeof(block) + capacity)) block;
+        b->refs.store(1, std::memory_order_relaxed);
+        b->next = 0;
+        b->owner = owner;
+        b->size_class = size_class;
+        b->capacity = capacity;
+        b->size = 0;
+        return b;
+    }
+
+    void deallocate( block *b )
+    {
+        b->~block();
+        ::operator delete(b);
+    }
+}
+
+//the pool of one thread. only the owner touches the free lists, other
+//threads return buffers through the remote stack. the stack is a treiber
+//stack with many producers and one consumer: the owner takes all entries
+//at once with an exchange, so a pop never races with another pop and the
+//stack has no ABA problem. the pool counts one reference for its thread
+//and one for every buffer out of the pool, the last one deletes it.
+class thread_cache : boost::noncopyable
+{
+    block *free_[size_classes];
+    std::size_t count_[size_classes];
+    std::atomic<block*> remote_;
+    std::atomic<std::size_t> refs_;
+
+    public:
+        thread_cache():
+            remote_(0),
+            refs_(1)
+        {
+            for( unsigned c = 0; c < size_classes; ++c )
+            {
+                free_[c] = 0;
+                count_[c] = 0;
+            }
+        }
+
+        ~thread_cache()
+        {
+            drain();
+            clear();
+        }
+
+        block* acquire( std::size_t capacity )
+        {
+            auto c = size_class(capacity);
+            if(c == size_classes)
+                return allocate(capacity, c, 0);
+
+            if(!free_[c])
+                drain();
+            block *b = free_[c];
+            if(b)
+            {
+                free_[c] = b->next;
+                --count_[c];
+                b->refs.store(1, std::memory_order_relaxed);
+                b->size = 0;
+            }
+            else
+                b = allocate(smallest << c, c, this);
+
+            refs_.fetch_add(1, std::memory_order_relaxed);
+            return b;
+        }
+
+        //a buffer back from the last handle on the owning thread
+        void release_local( block *b )
+        {
+            keep(b);
+            unref();
+        }
+
+        //a buffer back from the last handle on any other thread. the push
+        //releases the bytes written by this thread to the owner.
+        void release_remote( block *b )
+        {
+            auto *head = remote_.load(std::memory_order_relaxed);
+            do
+                b->next = head;
+            while(!remote_.compare_exchange_weak(head, b, std::memory_order_release, std::memory_order_relaxed));
+            unref();
+        }
+
+        //the thread exits, buffers still out of the pool keep it alive
+        void retire()
+        {
+            clear();
+            unref();
+        }
+
+        std::size_t pooled()
+        {
+            drain();
+            std::size_t n = 0;
+            for( unsigned c = 0; c < size_classes; ++c )
+                n += count_[c];
+            return n;
+        }
+
+    private:
+        void keep( block *b )
+        {
+            auto c = b->size_class;
+            if(count_[c] * (smallest << c) >= cached_bytes)
+            {
+                deallocate(b);
+                return;
+            }
+            b->next = free_[c];
+            free_[c] = b;
+            ++count_[c];
+        }
+
+        //moves the buffers returned by other threads to the free lists
+        void drain()
+        {
+            block *b = remote_.exchange(0, std::memory_order_acquire);
+            while(b)
+            {
+                block *next = b->next;
+                keep(b);
+                b = next;
+            }
+        }
+
+        void clear()
+        {
+            for( unsigned c = 0; c < size_classes; ++c )
+            {
+                while(free_[c])
+                {
+                    block *next = free_[c]->next;
+                    deallocate(free_[c]);
+                    free_[c] = next;
+                }
+                count_[c] = 0;
+            }
+        }
+
+        void unref()
+        {
+            if(refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+};
+
+namespace
+{
+    //the pool of the calling thread, 0 before its first buffer and after
+    //the thread has retired it
+    thread_local thread_cache *current = 0;
+
+    struct cache_holder
+    {
+        thread_cache *cache;
+
+        cache_holder():
+            cache(new thread_cache)
+        {
+            current = cache;
+        }
+
+        ~cache_holder()
+        {
+            current = 0;
+            cache->retire();
+        }
+    };
+
+    thread_cache& local_cache()
+    {
+        static thread_local cache_holder holder;
+        return *holder.cache;
+    }
+
+    void release( block *b )
+    {
+        if(b->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        if(!b->owner)
+            deallocate(b);
+        else if(b->owner == current)
+            b->owner->release_local(b);
+        else
+            b->owner->release_remote(b);
+    }
+}
+
+//--------------------------------------------------------------------------------
+
+output_buffer::output_buffer():
+    block_(0)
+{
+
+}
+
+output_buffer::output_buffer( std::size_t capacity ):
+    block_(local_cache().acquire(capacity))
+{
+
+}
+
+output_buffer::output_buffer( const output_buffer &other ):
+    block_(other.block_)
+{
+    if(block_)
+        block_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+output_buffer::output_buffer( output_buffer &&other ):
+    block_(other.block_)
+{
+    other.block_ = 0;
+}
+
+output_buffer& output_buffer::operator=( output_buffer other )
+{
+    swap(other);
+    return *this;
+}
+
+output_buffer::~output_buffer()
+{
+    reset();
+}
+
+void output_buffer::swap( output_buffer &other )
+{
+    std::swap(block_, other.block_);
+}
+
+void output_buffer::reset()
+{
+    if(block_)
+        release(block_);
+    block_ = 0;
+}
+
+char* output_buffer::data()
+{
+    return block_ ? block_->data() : 0;
+}
+
+const char* output_buffer::data() const
+{
+    return block_ ? block_->data() : 0;
+}
+
+std::size_t output_buffer::size() const
+{
+    return block_ ? block_->size : 0;
+}
+
+std::size_t output_buffer::capacity() const
+{
+    return block_ ? block_->capacity : 0;
+}
+
+void output_buffer::resize( std::size_t size )
+{
+    if(size > capacity())
+        throw std::string("output buffer size above its capacity");
+    if(block_)
+        block_->size = size;
+}
+
+std::size_t output_buffer::pooled()
+{
+    return local_cache().pooled();
+}
+
+}
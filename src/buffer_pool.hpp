@@ -0,0 +1,74 @@
+/*buffer_pool.hpp
+ *
+ * Pooled output buffers for composed messages. A message that is written
+ * to a device has to live until the write completes. Allocating a string
+ * for every message makes the allocator churn grow with the outbound rate.
+ * Buffers are instead taken from a pool of the calling thread, in size
+ * classes of powers of two from 64 bytes to 64 KiB. Larger buffers are
+ * allocated and freed directly.
+ *
+ * An output_buffer is a reference counted handle. It is handed to the
+ * transport as it is, e.g. captured in the completion handler of an
+ * asynchronous write:
+ *
+ *   composer::output_buffer out;
+ *   msg.format(slots, count, &out);
+ *   boost::asio::async_write(port, boost::asio::buffer(out.data(), out.size()),
+ *           [out]( const boost::system::error_code&, std::size_t ) {});
+ *
+ * When the last handle is gone the buffer goes back to the pool it was
+ * taken from. On the owning thread that is a push onto a free list. Any
+ * other thread pushes it onto a lock-free stack of the owner, which the
+ * owner moves to its free lists when it runs out of buffers of a class.
+ * A pool outlives its thread until all of its buffers have come back.
+ * */
+
+#ifndef __BUFFER_POOL_INCLUDE_GUARD_14_52__
+#define __BUFFER_POOL_INCLUDE_GUARD_14_52__
+
+//std
+#include <cstddef>
+
+namespace composer
+{
+
+class output_buffer
+{
+    public:
+        struct block; //header in front of the bytes, see buffer_pool.cpp
+
+    private:
+        block *block_;
+
+    public:
+        output_buffer(); //empty, without a buffer
+
+        //a buffer of at least capacity bytes from the pool of the calling
+        //thread, its size is 0
+        explicit output_buffer( std::size_t capacity );
+
+        output_buffer( const output_buffer &other );
+        output_buffer( output_buffer &&other );
+        output_buffer& operator=( output_buffer other );
+        ~output_buffer();
+
+        void swap( output_buffer &other );
+        void reset(); //drops the reference, the handle is empty afterwards
+
+        bool empty() const { return block_ == 0; }
+        char* data();
+        const char* data() const;
+        std::size_t size() const;
+        std::size_t capacity() const;
+
+        //sets the bytes in use, throws a std::string above capacity
+        void resize( std::size_t size );
+
+        //the free buffers in the pool of the calling thread, including those
+        //returned by other threads that are not yet moved to the free lists
+        static std::size_t pooled();
+};
+
+} //namespace composer
+
+#endif
@@ -0,0 +1,405 @@
+
+#include "checksum.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHECKSUM_HAVE_CLMUL 1
+#include <immintrin.h>
+#endif
+
+namespace checksum
+{
+
+namespace
+{
+    //slice-by-8 tables of a reflected crc. table[0] is the classic byte
+    //table, table[k][b] is the crc of byte b followed by k zero bytes.
+    struct crc_tables
+    {
+        boost::uint32_t table[8][256];
+
+        crc_tables( boost::uint32_t poly )
+        {
+            for( boost::uint32_t b = 0; b < 256; ++b )
+            {
+                boost::uint32_t c = b;
+                for( int k = 0; k < 8; ++k )
+                    c = (c & 1) ? (c >> 1) ^ poly : c >> 1;
+                table[0][b] = c;
+            }
+
+            for( int k = 1; k < 8; ++k )
+                for( int b = 0; b < 256; ++b )
+                    table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+        }
+    };
+
+    const crc_tables& crc32_tables()
+    {
+        static const crc_tables tables(0xEDB88320u);
+        return tables;
+    }
+
+    const crc_tables& crc16_tables()
+    {
+        static const crc_tables tables(0xA001u);
+        return tables;
+    }
+
+    inline boost::uint32_t load_le32( const unsigned char *p )
+    {
+        return boost::uint32_t(p[0]) | (boost::uint32_t(p[1]) << 8)
+            | (boost::uint32_t(p[2]) << 16) | (boost::uint32_t(p[3]) << 24);
+    }
+
+    boost::uint32_t crc_slice8( const crc_tables &tb, boost::uint32_t crc,
+            const unsigned char *p, std::size_t n )
+    {
+        const auto &t = tb.table;
+        for(; n >= 8; n -= 8, p += 8 )
+        {
+            boost::uint32_t one = load_le32(p) ^ crc;
+            boost::uint32_t two = load_le32(p + 4);
+            crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF]
+                ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24]
+                ^ t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF]
+                ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        }
+
+        for(; n; --n, ++p )
+            crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+        return crc;
+    }
+
+#ifdef CHECKSUM_HAVE_CLMUL
+    //folds 64 byte blocks with carry-less multiplication and reduces the
+    //remainder with a barrett reduction, see the intel paper "fast crc
+    //computation for generic polynomials using pclmulqdq". needs at least 64
+    //bytes and a multiple of 16.
+    __attribute__((target("pclmul,sse4.1")))
+    boost::uint32_t crc32_clmul( boost::uint32_t crc, const unsigned char *buf, std::size_t len )
+    {
+        alignas(16) static const boost::uint64_t k1k2[] = { 0x0154442bd4ull, 0x01c6e41596ull };
+        alignas(16) static const boost::uint64_t k3k4[] = { 0x01751997d0ull, 0x00ccaa009eull };
+        alignas(16) static const boost::uint64_t k5k0[] = { 0x0163cd6124ull, 0x0000000000ull };
+        alignas(16) static const boost::uint64_t poly[] = { 0x01db710641ull, 0x01f7011641ull };
+
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+        x1 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+        x2 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+        x3 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+        x4 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+        x0 = _mm_load_si128((const __m128i*)k1k2);
+
+        buf += 64;
+        len -= 64;
+
+        while(len >= 64)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+            y5 = _mm_loadu_si128((const __m128i*)(buf + 0x00));
+            y6 = _mm_loadu_si128((const __m128i*)(buf + 0x10));
+            y7 = _mm_loadu_si128((const __m128i*)(buf + 0x20));
+            y8 = _mm_loadu_si128((const __m128i*)(buf + 0x30));
+
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+            buf += 64;
+            len -= 64;
+        }
+
+        //fold the four lanes into one
+        x0 = _mm_load_si128((const __m128i*)k3k4);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+        while(len >= 16)
+        {
+            x2 = _mm_loadu_si128((const __m128i*)buf);
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+            buf += 16;
+            len -= 16;
+        }
+
+        //128 to 64 bits
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_srli_si128(x1, 8);
+        x1 = _mm_xor_si128(x1, x2);
+
+        x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        //barrett reduction to 32 bits
+        x0 = _mm_load_si128((const __m128i*)poly);
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        return static_cast<boost::uint32_t>(_mm_extract_epi32(x1, 1));
+    }
+
+    bool have_clmul()
+    {
+        static const bool have = __builtin_cpu_supports("pclmul") and __builtin_cpu_supports("sse4.1");
+        return have;
+    }
+#endif
+
+    boost::uint32_t crc32_update( boost::uint32_t crc, const unsigned char *p, std::size_t n )
+    {
+#ifdef CHECKSUM_HAVE_CLMUL
+        if(n >= 64 and have_clmul())
+        {
+            std::size_t bulk = n & ~std::size_t(15);
+            crc = crc32_clmul(crc, p, bulk);
+            p += bulk;
+            n -= bulk;
+        }
+#endif
+        return crc_slice8(crc32_tables(), crc, p, n);
+    }
+
+    inline boost::uint32_t xor_update( boost::uint32_t reg, const unsigned char *p, std::size_t n )
+    {
+        boost::uint64_t acc = 0, word;
+        for(; n >= 8; n -= 8, p += 8 )
+        {
+            std::memcpy(&word, p, 8);
+            acc ^= word;
+        }
+        acc ^= acc >> 32;
+        acc ^= acc >> 16;
+        acc ^= acc >> 8;
+
+        reg ^= static_cast<boost::uint32_t>(acc & 0xFF);
+        for(; n; --n, ++p )
+            reg ^= *p;
+        return reg;
+    }
+
+    inline boost::uint32_t sum_update( boost::uint32_t reg, const unsigned char *p, std::size_t n )
+    {
+        for(; n; --n, ++p )
+            reg += *p;
+        return reg & 0xFF;
+    }
+
+    //below this size a crc segment is scanned, the matrix costs about as
+    //much as slice-by-8 over 32 bytes
+    const std::size_t combine_threshold = 32;
+
+    //GF(2) matrices are stored as 32 columns, see zlib's crc32_combine
+    inline boost::uint32_t gf2_times( const boost::uint32_t *mat, boost::uint32_t vec )
+    {
+        boost::uint32_t sum = 0;
+        for(; vec; vec >>= 1, ++mat )
+        {
+            if(vec & 1)
+                sum ^= *mat;
+        }
+        return sum;
+    }
+
+    //result = a after b
+    void gf2_multiply( boost::uint32_t *result, const boost::uint32_t *a, const boost::uint32_t *b )
+    {
+        boost::uint32_t out[32];
+        for( int k = 0; k < 32; ++k )
+            out[k] = gf2_times(a, b[k]);
+        std::memcpy(result, out, sizeof(out));
+    }
+
+    //the move of a reflected crc register over n zero bytes
+    void zero_shift( boost::uint32_t poly, std::size_t n, boost::uint32_t *result )
+    {
+        boost::uint32_t base[32];
+        base[0] = poly; //one zero bit
+        for( int k = 1; k < 32; ++k )
+            base[k] = boost::uint32_t(1) << (k - 1);
+        for( int k = 0; k < 3; ++k )
+            gf2_multiply(base, base, base); //one zero byte
+
+        for( int k = 0; k < 32; ++k )
+            result[k] = boost::uint32_t(1) << k;
+        for(; n; n >>= 1 )
+        {
+            if(n & 1)
+                gf2_multiply(result, base, result);
+            gf2_multiply(base, base, base);
+        }
+    }
+
+    boost::uint32_t raw_update( algorithm algo, boost::uint32_t reg, const char *data, std::size_t size )
+    {
+        auto p = reinterpret_cast<const unsigned char*>(data);
+        switch(algo)
+        {
+            case xor8:
+                return xor_update(reg, p, size);
+            case lrc8:
+                return sum_update(reg, p, size);
+            case crc16:
+            case crc16_modbus:
+                return crc_slice8(crc16_tables(), reg, p, size);
+            case crc32:
+                return crc32_update(reg, p, size);
+        }
+        return reg;
+    }
+
+    boost::uint32_t crc_poly( algorithm algo )
+    {
+        return algo == crc32 ? 0xEDB88320u : 0xA001u;
+    }
+}
+
+algorithm from_name( const std::string &name )
+{
+    if(name == "xor")
+        return xor8;
+    if(name == "lrc")
+        return lrc8;
+    if(name == "crc16")
+        return crc16;
+    if(name == "crc16modbus")
+        return crc16_modbus;
+    if(name == "crc32")
+        return crc32;
+
+    throw std::string("no such checksum algorithm: ") + name;
+}
+
+std::size_t width( algorithm algo )
+{
+    switch(algo)
+    {
+        case crc16:
+        case crc16_modbus:
+            return 2;
+        case crc32:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+state::state( algorithm algo ):
+    algo_(algo)
+{
+    reset();
+}
+
+void state::reset()
+{
+    switch(algo_)
+    {
+        case crc16_modbus:
+            reg_ = 0xFFFF;
+            break;
+        case crc32:
+            reg_ = 0xFFFFFFFFu;
+            break;
+        default:
+            reg_ = 0;
+            break;
+    }
+}
+
+segment::segment( algorithm algo, const char *data, std::size_t size ):
+    algo_(algo),
+    reg_(0),
+    combine_(true)
+{
+    std::memset(shift_, 0, sizeof(shift_));
+
+    bool crc = algo == crc16 or algo == crc16_modbus or algo == crc32;
+    if(crc and size < combine_threshold)
+    {
+        combine_ = false;
+        short_.assign(data, size);
+        return;
+    }
+
+    reg_ = raw_update(algo, 0, data, size);
+    if(crc)
+        zero_shift(crc_poly(algo), size, shift_);
+}
+
+void state::append( const segment &seg )
+{
+    switch(algo_)
+    {
+        case xor8:
+            reg_ ^= seg.reg_;
+            break;
+        case lrc8:
+            reg_ = (reg_ + seg.reg_) & 0xFF;
+            break;
+        default:
+            if(!seg.combine_)
+                update(seg.short_.data(), seg.short_.size());
+            else
+                reg_ = gf2_times(seg.shift_, reg_) ^ seg.reg_;
+            break;
+    }
+}
+
+void state::update( const char *data, std::size_t size )
+{
+    reg_ = raw_update(algo_, reg_, data, size);
+}
+
+boost::uint32_t state::value() const
+{
+    switch(algo_)
+    {
+        case lrc8:
+            return (0x100 - reg_) & 0xFF;
+        case crc32:
+            return ~reg_;
+        default:
+            return reg_;
+    }
+}
+
+boost::uint32_t compute( algorithm algo, const char *data, std::size_t size )
+{
+    state st(algo);
+    st.update(data, size);
+    return st.value();
+}
+
+} //namespace checksum
@@ -0,0 +1,81 @@
+/*checksum.hpp
+ *
+ * Checksums of serial protocols: XOR, LRC and the reflected CRC-16 and
+ * CRC-32 variants. A state is updated with the bytes as they are produced,
+ * so composing a message never needs a second pass over the output.
+ * The CRCs are table driven (slice-by-8). Long CRC-32 runs use carry-less
+ * multiplication when the CPU supports it.
+ * Constant bytes can be prepared once as a segment. Appending a segment
+ * folds it into a state without reading its bytes again. For the CRCs it
+ * is combined as in zlib's crc32_combine.
+ * */
+
+#ifndef __CHECKSUM_INCLUDE_GUARD_11_42__
+#define __CHECKSUM_INCLUDE_GUARD_11_42__
+
+//std
+#include <string>
+#include <cstddef>
+
+//boost
+#include <boost/cstdint.hpp>
+
+namespace checksum
+{
+
+enum algorithm
+{
+    xor8,       //xor of all bytes
+    lrc8,       //two's complement of the byte sum
+    crc16,      //CRC-16/ARC, poly 0x8005 reflected, init 0
+    crc16_modbus, //CRC-16/MODBUS, poly 0x8005 reflected, init 0xFFFF
+    crc32       //CRC-32 as used by zlib and ethernet
+};
+
+//maps "xor", "lrc", "crc16", "crc16modbus" and "crc32" to the algorithm.
+//throws a std::string on an unknown name.
+algorithm from_name( const std::string &name );
+
+//size of the checksum value in bytes
+std::size_t width( algorithm algo );
+
+//the contribution of constant bytes to a checksum. a crc register is
+//linear: the register after the bytes is the register moved over as many
+//zero bytes, xor the register of the bytes alone. the move is a 32x32
+//matrix over GF(2) and is prepared with the register. short runs are
+//cheaper to scan again, they only keep a copy of their bytes.
+class segment
+{
+    friend class state;
+
+    algorithm algo_;
+    boost::uint32_t reg_; //register of the bytes, starting from zero
+    boost::uint32_t shift_[32]; //columns of the zero byte move
+    bool combine_; //false for short crc runs, they keep their bytes
+    std::string short_;
+
+    public:
+        segment( algorithm algo, const char *data, std::size_t size );
+};
+
+class state
+{
+    algorithm algo_;
+    boost::uint32_t reg_; //raw register, init and final xor are applied outside
+
+    public:
+        explicit state( algorithm algo = xor8 );
+
+        void reset();
+        void update( const char *data, std::size_t size );
+        void append( const segment &seg ); //same as update with the bytes of seg
+        boost::uint32_t value() const; //the final checksum
+        algorithm algo() const { return algo_; }
+};
+
+//one shot helpers
+boost::uint32_t compute( algorithm algo, const char *data, std::size_t size );
+
+} //namespace checksum
+
+#endif
@@ -1,238 +1,862 @@
-
 #include "composer.hpp"
 #include "common.hpp"
+#include "checksum.hpp"
+#include "buffer_pool.hpp"
+#include "field_writer.hpp"
 #include <boost/unordered_map.hpp>
-#include <boost/functional/factory.hpp>
 #include <boost/format.hpp>
 #include <boost/function.hpp>
 #include <boost/make_shared.hpp>
-#include <boost/date_time.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/lock_guard.hpp>
 #include <vector>
+#include <algorithm>
 #include <sstream>
-#include <iostream> //debug
+#include <cstring>
+#include <ctime>
+#include <exception>
 
 namespace composer
 {
 
-struct fragment
+//the cache of one rendered timestamp format
+struct stamp_cache
 {
-    virtual void value( const input *ip, std::string *value ) const = 0;
-    virtual ~fragment(){};
-    
-    typedef boost::shared_ptr<fragment> pointer;
+    boost::int64_t tick; //second or millisecond of the text, -1 if empty
+    std::string text;
+};
+
+//every distinct $now format has an id, the context keeps its cache at
+//that index. the ids are handed out when messages are compiled.
+class context::impl
+{
+    public:
+        std::vector<stamp_cache> stamps_;
+        sequence_counters *counters_;
+
+        impl():
+            counters_(0)
+        {
+        }
+
+        stamp_cache& stamp( std::size_t id )
+        {
+            if(id >= stamps_.size())
+                stamps_.resize(id + 1, stamp_cache{-1, std::string()});
+            return stamps_[id];
+        }
+};
+
+//state of one format call. slots holds the field values in the order of
+//message::keys(), sum is the running checksum over the summed ops.
+struct run_context
+{
+    const value_ref *slots;
+    checksum::state sum;
+    const context::impl &cache;
 };
 
-//literal just return the same value that is handled over
-//by the constructor. the input parameter is ignored.
+//field_format is a printf style spec of a field, compiled once when the
+//message is built. the common conversions are written by hand straight
+//into the output: zero padded integers (d, i, u), hex (x, X) and strings
+//with width and precision (s), by the writers of field_writer.hpp. the input value is a string, integer
+//conversions parse it first and fall back to string output if it is not a
+//number. any other spec is handed to a boost::format object that is parsed
+//once and copied on each call.
+//
+//a spec may also name a binary encoding, the value is then written as bytes:
+//  u8, i8, u16be, u16le, i16be, ... i64le  packed integers
+//  bcdN                                    N bytes of packed BCD, zero padded
+//  lp8, lp16be, lp16le                     the bytes after their length
+//integers and BCD values that do not fit throw a std::string.
 //--------------------------------------------------------------------------------
 
-struct literal : public fragment
+struct field_format
 {
-    std::string value_;
-    literal( const std::string &v):
-        value_(v)
+    enum conversion { text, decimal, hex_lower, hex_upper, generic, binary_int, bcd, length_prefixed };
+
+    conversion conv_;
+    bool left_, zero_, plus_, space_;
+    bool signed_, big_endian_; //binary integers and length prefixes
+    std::size_t bin_size_; //bytes of a binary integer, BCD value or length prefix
+    std::size_t width_;
+    int precision_; //-1 if not given
+    std::string prefix_, suffix_; //literal text around the spec
+    boost::shared_ptr<boost::format> generic_;
+    std::size_t generic_bound_; //spec size plus all numbers in it
+    std::string spec_; //the source, kept for message::save
+
+    field_format( const std::string &spec ):
+        conv_(text), left_(false), zero_(false), plus_(false), space_(false),
+        signed_(false), big_endian_(true), bin_size_(0),
+        width_(0), precision_(-1), generic_bound_(0), spec_(spec)
     {
+        if(compile_binary(spec))
+            return;
+        if(!compile(spec))
+        {
+            conv_ = generic;
+            //specs boost::format reads differently fail here and not when
+            //the message is formatted, one argument is what write passes
+            try
+            {
+                generic_ = boost::make_shared<boost::format>(spec);
+                boost::format probe(*generic_);
+                boost::str(probe % std::string());
+            }
+            catch( const boost::io::format_error &e )
+            {
+                throw std::string("invalid field format ") + spec + ": " + e.what();
+            }
+            generic_bound_ = spec.size();
+            for( std::size_t pos = 0; pos < spec.size(); ++pos )
+                generic_bound_ += read_number(spec, pos);
+        }
     }
 
-    virtual void value( const input*, std::string *value ) const
+    static std::size_t read_number( const std::string &s, std::size_t &pos )
     {
-        (*value) += value_;
+        std::size_t n = 0;
+        for(; pos < s.size() and s[pos] >= '0' and s[pos] <= '9'; ++pos)
+            n = n * 10 + (s[pos] - '0');
+        return n;
     }
 
-};
+    //appends literal text up to the next conversion, false on a second one
+    static bool literal_text( const std::string &s, std::size_t &pos, std::string &out )
+    {
+        for(; pos < s.size(); ++pos)
+        {
+            if(s[pos] != '%')
+                out += s[pos];
+            else if(pos + 1 < s.size() and s[pos + 1] == '%')
+                out += s[++pos];
+            else
+                return false;
+        }
+        return true;
+    }
 
-//field must receive a value from an external dat source,
-//provided by the input parameter.
-//--------------------------------------------------------------------------------
+    bool compile_binary( const std::string &spec )
+    {
+        std::size_t pos = 0;
+        if(spec.compare(0, 3, "bcd") == 0)
+        {
+            pos = 3;
+            bin_size_ = read_number(spec, pos);
+            if(pos != spec.size() or bin_size_ == 0 or bin_size_ > 32)
+                return false;
+            conv_ = bcd;
+            return true;
+        }
 
-struct field : public fragment
-{
-    std::string key_name_, format_;
-    field( const std::string &key, const std::string &fm ):
-        key_name_(key), 
-        format_(fm)
+        if(spec.compare(0, 2, "lp") == 0)
+        {
+            conv_ = length_prefixed;
+            pos = 2;
+        }
+        else if(!spec.empty() and (spec[0] == 'u' or spec[0] == 'i'))
+        {
+            conv_ = binary_int;
+            signed_ = spec[0] == 'i';
+            pos = 1;
+        }
+        else
+            return false;
+
+        auto bits = read_number(spec, pos);
+        std::string order = spec.substr(pos);
+        bool valid = conv_ == binary_int ? (bits == 8 or bits == 16 or bits == 32 or bits == 64) 
+            : (bits == 8 or bits == 16);
+        if(bits == 8)
+            valid = valid and order.empty();
+        else
+            valid = valid and (order == "be" or order == "le");
+
+        if(!valid)
+        {
+            conv_ = text;
+            signed_ = false;
+            return false;
+        }
+        bin_size_ = bits / 8;
+        big_endian_ = order != "le";
+        return true;
+    }
+
+    bool compile( const std::string &spec )
     {
-    
+        std::size_t pos = 0;
+        if(literal_text(spec, pos, prefix_))
+            return true; //no conversion at all, plain string output
+
+        for(++pos; pos < spec.size(); ++pos)
+        {
+            switch(spec[pos])
+            {
+                case '-': left_ = true; continue;
+                case '0': zero_ = true; continue;
+                case '+': plus_ = true; continue;
+                case ' ': space_ = true; continue;
+            }
+            break;
+        }
+
+        width_ = read_number(spec, pos);
+        if(pos < spec.size() and spec[pos] == '.')
+            precision_ = static_cast<int>(read_number(spec, ++pos));
+
+        while(pos < spec.size() and std::strchr("hlLqjzt", spec[pos]))
+            ++pos;
+        if(pos == spec.size())
+            return false;
+
+        switch(spec[pos++])
+        {
+            case 'd': case 'i': case 'u': conv_ = decimal; break;
+            case 'x': conv_ = hex_lower; break;
+            case 'X': conv_ = hex_upper; break;
+            case 's': conv_ = text; break;
+            default: return false;
+        }
+
+        return literal_text(spec, pos, suffix_);
+    }
+
+    //exact output size for every integer of up to the given digits, 0 if
+    //the size depends on the value
+    std::size_t fixed_size( std::size_t digits ) const
+    {
+        if(conv_ == binary_int or conv_ == bcd)
+            return bin_size_;
+        if(conv_ != decimal and conv_ != hex_lower and conv_ != hex_upper)
+            return 0;
+        std::size_t widest = std::max<std::size_t>(digits, precision_ > 0 ? precision_ : 0) + (plus_ or space_ ? 1 : 0);
+        return width_ >= widest ? prefix_.size() + suffix_.size() + width_ : 0;
+    }
+
+    //the most bytes write can produce for a value of the given size. for
+    //integers the digits of the largest parsed value are assumed.
+    std::size_t bound( std::size_t size ) const
+    {
+        switch(conv_)
+        {
+            case generic: return generic_bound_ + size;
+            case binary_int: case bcd: return bin_size_;
+            case length_prefixed: return bin_size_ + size;
+            default: break;
+        }
+
+        return prefix_.size() + suffix_.size() + detail::value_bound(conv_ != text, width_, precision_, size);
+    }
+
+    //the exact size write produces for a value, without writing it. only
+    //generic specs give their bound, they never take part in a fixed layout.
+    std::size_t written_size( const char *v, std::size_t size ) const
+    {
+        switch(conv_)
+        {
+            case generic: return bound(size);
+            case binary_int: case bcd: return bin_size_;
+            case length_prefixed: return bin_size_ + size;
+            default: break;
+        }
+
+        return prefix_.size() + suffix_.size() 
+            + detail::value_size(v, size, conv_ != text, base(), positive(), width_, precision_);
+    }
+
+    unsigned base() const
+    {
+        return (conv_ == hex_lower or conv_ == hex_upper) ? 16 : 10;
+    }
+
+    char positive() const
+    {
+        return plus_ ? '+' : (space_ ? ' ' : 0);
+    }
+
+    char* write_integer( bool negative, boost::uint64_t value, char *out ) const
+    {
+        return detail::write_integer(negative, value, out, base(), conv_ == hex_upper, 
+                left_, zero_, positive(), width_, precision_);
+    }
+
+    //the generic path renders through boost::format and checks the bound,
+    //so a surprising spec can never write past the reserved space
+    template<typename T>
+    char* write_generic( const T &value, std::size_t size, char *out ) const
+    {
+        boost::format fm(*generic_);
+        auto rendered = boost::str(fm % value);
+        if(rendered.size() > bound(size))
+            throw std::string("field format exceeds its size bound");
+        return detail::copy(out, rendered.data(), rendered.size());
+    }
+
+    //the size of every output of the spec, 0 if it depends on the value
+    std::size_t fixed_width() const
+    {
+        switch(conv_)
+        {
+            case generic: case length_prefixed: return 0;
+            case binary_int: case bcd: return bin_size_;
+            default: return width_ ? prefix_.size() + suffix_.size() + width_ : 0;
+        }
+    }
+
+    //the bytes of value, most significant first if big endian
+    char* write_bytes( boost::uint64_t value, std::size_t size, char *out ) const
+    {
+        for( std::size_t i = 0; i < size; ++i )
+        {
+            auto shift = 8 * (big_endian_ ? size - 1 - i : i);
+            *out++ = static_cast<char>((value >> shift) & 0xFF);
+        }
+        return out;
+    }
+
+    char* write_binary_int( bool negative, boost::uint64_t magnitude, char *out ) const
+    {
+        auto bits = 8 * bin_size_;
+        boost::uint64_t limit = bits == 64 ? ~boost::uint64_t(0) : (boost::uint64_t(1) << bits) - 1;
+        if(signed_)
+            limit >>= 1;
+        if(negative and !signed_ and magnitude)
+            throw std::string("negative value for unsigned field ") + spec_;
+        if(magnitude > limit + (negative ? 1 : 0))
+            throw std::string("value out of range for field ") + spec_;
+        return write_bytes(negative ? ~magnitude + 1 : magnitude, bin_size_, out);
+    }
+
+    char* write_binary( const char *v, std::size_t size, char *out ) const
+    {
+        if(conv_ == length_prefixed)
+        {
+            if(size >> (8 * bin_size_))
+                throw std::string("value too long for field ") + spec_;
+            out = write_bytes(size, bin_size_, out);
+            return detail::copy(out, v, size);
+        }
+
+        if(conv_ == bcd)
+        {
+            if(size > 2 * bin_size_)
+                throw std::string("value too long for field ") + spec_;
+            char *begin = out;
+            out = detail::pad(out, 0, bin_size_);
+            //digits fill the bytes from the last nibble backwards
+            for( std::size_t i = 0; i < size; ++i )
+            {
+                unsigned char digit = v[size - 1 - i] - '0';
+                if(digit > 9)
+                    throw std::string("no decimal digits for field ") + spec_;
+                begin[bin_size_ - 1 - i / 2] |= (i % 2) ? digit << 4 : digit;
+            }
+            return out;
+        }
+
+        //full 64 bit range, unlike detail::parse_integer
+        std::size_t pos = 0;
+        bool negative = size and v[0] == '-';
+        if(size and (v[0] == '-' or v[0] == '+'))
+            ++pos;
+        if(pos == size)
+            throw std::string("no integer for field ") + spec_;
+        boost::uint64_t value = 0;
+        for(; pos < size; ++pos)
+        {
+            unsigned digit = v[pos] - '0';
+            if(digit > 9 or value > (~boost::uint64_t(0) - digit) / 10)
+                throw std::string("no integer in range for field ") + spec_;
+            value = value * 10 + digit;
+        }
+        return write_binary_int(negative, value, out);
+    }
+
+    //the spec of numbers that are written without one, compiled once
+    static const field_format& plain_decimal()
+    {
+        static const field_format plain("%d");
+        return plain;
+    }
+
+    //writes a number that is not read from a string, e.g. a checksum
+    char* write_number( boost::uint64_t number, char *out ) const
+    {
+        if(conv_ == generic)
+            return write_generic(number, 20, out);
+        if(conv_ == binary_int)
+            return write_binary_int(false, number, out);
+        if(conv_ == bcd or conv_ == length_prefixed)
+        {
+            char digits[24];
+            return write_binary(digits, plain_decimal().write_integer(false, number, digits) - digits, out);
+        }
+
+        out = detail::copy(out, prefix_.data(), prefix_.size());
+        if(conv_ == text)
+            out = plain_decimal().write_integer(false, number, out);
+        else
+            out = write_integer(false, number, out);
+        return detail::copy(out, suffix_.data(), suffix_.size());
     }
 
-    virtual void value( const input *ip, std::string *value ) const
+    char* write( const char *v, std::size_t size, char *out ) const
     {
-        (*value) += boost::str( boost::format(format_) % (*ip)[key_name_] );
+        if(conv_ == generic)
+            return write_generic(std::string(v, size), size, out);
+        if(conv_ >= binary_int)
+            return write_binary(v, size, out);
+
+        out = detail::copy(out, prefix_.data(), prefix_.size());
+        out = detail::write_value(v, size, out, conv_ != text, base(), conv_ == hex_upper, 
+                left_, zero_, positive(), width_, precision_);
+        return detail::copy(out, suffix_.data(), suffix_.size());
     }
 };
 
+//compiled messages
+//--------------------------------------------------------------------------------
+//a message is compiled into a contiguous array of tagged op records. an op
+//holds no pointers, it refers to its data by index: literal bytes live in
+//one pool, field formats and timestamps in tables next to the ops. format
+//is one loop with a switch over the op code.
+
+enum opcode { op_literal, op_field, op_repeat, op_now, op_checksum, op_seq };
+
+struct op
+{
+    boost::uint8_t code;
+    boost::uint8_t summed; //output is part of the checksummed region
+    boost::uint16_t segment; //summed op_literal: index into segments_
+    boost::uint32_t a, b;
+    //op_literal:  a pool offset, b size
+    //op_field:    a slot, b index into formats_
+    //op_repeat:   a char, b count
+    //op_now:      a index into stamps_
+    //op_checksum: no arguments, see program::sum_
+    //op_seq:      a index into seqs_
+};
+
 namespace functions
 {
 
-    struct function_base
+    std::size_t stamp_id( const std::string &format )
     {
-        function_base( const common::string_list &list ){}
-        virtual void operator()( std::string *str ) = 0;
-        virtual ~function_base(){}
-        
-    };
+        static boost::mutex mutex;
+        static boost::unordered_map<std::string, std::size_t> ids;
+
+        boost::lock_guard<boost::mutex> lock(mutex);
+        auto itr = ids.find(format);
+        if(itr != ids.end())
+            return itr->second;
+        auto id = ids.size();
+        ids[format] = id;
+        return id;
+    }
 
-    struct checksum : public function_base
+    //$now(format) renders the local time with a strftime format. %L adds
+    //the milliseconds. the rendered string is cached in the context and only
+    //refreshed when the second, or with %L the millisecond, has changed.
+    //seconds are read from the coarse clock, which costs a few nanoseconds.
+    struct now
     {
-        bool int_output_;
-        std::string format_;
-        checksum( const common::string_list &list ):
-            function_base(list)
+        common::string_list params_; //the source, kept for message::save
+        common::string_list parts_; //format split at every %L
+        bool millis_;
+        std::size_t id_; //index of the cache in a context
+
+        now( const common::string_list &list ):
+            params_(list),
+            millis_(false),
+            id_(0)
         {
-            if(list.size() < 1)
-                throw std::string("arity error: in checksum function are at least 1 parameter expected");
 
-            format_ = list[0];
-            int_output_ = list[1] != "false";
+            if(list.size() < 1 )
+                throw std::string("arity error: now function needs at least one argument");
+            id_ = stamp_id(list[0]);
+
+            const auto &fm = list[0];
+            std::string part;
+            for( std::size_t i = 0; i < fm.size(); ++i )
+            {
+                if(fm[i] == '%' and i + 1 < fm.size() and fm[i + 1] == 'L')
+                {
+                    parts_.push_back(part);
+                    part.clear();
+                    millis_ = true;
+                    ++i;
+                    continue;
+                }
+                if(fm[i] == '%' and i + 1 < fm.size())
+                    part += fm[i++];
+                part += fm[i];
+            }
+            parts_.push_back(part);
         }
 
-        virtual void operator()( std::string *rs )
+        void render( const timespec &ts, std::string &text ) const
         {
-            auto itr = rs->begin();
-            auto nd = rs->end();
-
-            if(*itr == (char)2) ++itr;
-            std::size_t int_res;
-            char char_res;
+            std::tm local;
+            localtime_r(&ts.tv_sec, &local);
 
-            if( int_output_ )
+            text.clear();
+            char buffer[256];
+            for( std::size_t i = 0; i < parts_.size(); ++i )
             {
-                for(; itr != nd; ++itr) int_res ^= *itr;
-                *rs += boost::str(boost::format(format_) % int_res);
+                if(i > 0)
+                {
+                    auto ms = ts.tv_nsec / 1000000;
+                    text += static_cast<char>('0' + ms / 100);
+                    text += static_cast<char>('0' + ms / 10 % 10);
+                    text += static_cast<char>('0' + ms % 10);
+                }
+                if(!parts_[i].empty())
+                    text.append(buffer, std::strftime(buffer, sizeof(buffer), parts_[i].c_str(), &local));
             }
+        }
+
+        //brings the cache up to date, format reads it with cached afterwards
+        const std::string& refresh( context::impl &ctx ) const
+        {
+            timespec ts;
+            clock_gettime(millis_ ? CLOCK_REALTIME : CLOCK_REALTIME_COARSE, &ts);
+            boost::int64_t tick = millis_ ? boost::int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000 : ts.tv_sec;
 
-            for(; itr != nd; ++itr) char_res ^= *itr;
-                *rs += char_res;
+            auto &cache = ctx.stamp(id_);
+            if(tick != cache.tick)
+            {
+                render(ts, cache.text);
+                cache.tick = tick;
+            }
+            return cache.text;
+        }
 
+        const std::string& cached( const context::impl &ctx ) const
+        {
+            return ctx.stamps_[id_].text;
         }
     };
 
-    struct now : public function_base
+    //$checksum(format, algorithm, skip, stop)
+    //format is a printf spec for text output, "raw" or empty for the value
+    //as big endian bytes. algorithm is one of checksum::from_name, the old
+    //"int" and "false" select xor with text or raw output. skip is the ascii
+    //code of a leading byte left out (default 2, STX), stop the ascii code
+    //of the byte the region ends with, inclusive (default: none, the region
+    //ends at the checksum). "-" disables skip or stop. the region is resolved
+    //against the literals when the message is built, so field values never
+    //move it, and the checksum is updated while the ops are run.
+    struct checksum
     {
-        std::stringstream ss_;
-        now( const common::string_list &list ):
-            function_base(list)
+        common::string_list params_; //the source, kept for message::save
+        bool text_output_;
+        boost::shared_ptr<field_format> format_;
+        ::checksum::algorithm algo_;
+        int skip_, stop_; //-1 if not used
+
+        static int ascii_param( const common::string_list &list, std::size_t pos, int def )
         {
+            if(list.size() <= pos or list[pos].empty())
+                return def;
+            if(list[pos] == "-")
+                return -1;
 
-            if(list.size() < 1 )
-                throw std::string("arity error: now function needs at least one argument");
+            std::stringstream ss(list[pos]);
+            int code;
+            if(!(ss >> code) or code < 0 or code > 255)
+                throw std::string("argument error: checksum region needs an ascii code, got ") + list[pos];
+            return code;
+        }
+
+        checksum():
+            text_output_(false),
+            algo_(::checksum::xor8),
+            skip_(-1),
+            stop_(-1)
+        {
+        }
+
+        checksum( const common::string_list &list ):
+            params_(list),
+            text_output_(true),
+            algo_(::checksum::xor8)
+        {
+            if(list.size() < 1)
+                throw std::string("arity error: in checksum function are at least 1 parameter expected");
+
+            std::string algo = list.size() > 1 ? list[1] : "int";
+            if(algo == "false")
+                text_output_ = false;
+            else if(algo != "int")
+                algo_ = ::checksum::from_name(algo);
+
+            if(list[0].empty() or list[0] == "raw")
+                text_output_ = false;
+            else if(text_output_)
+                format_ = boost::make_shared<field_format>(list[0]);
 
-            namespace tm = boost::posix_time;
-            auto facet = new tm::time_facet(list[0].c_str());
-            std::stringstream ss_;
-            ss_.imbue(std::locale(std::locale::classic(), facet));
-            
+            skip_ = ascii_param(list, 2, 2);
+            stop_ = ascii_param(list, 3, -1);
         }
 
-        virtual void operator()( std::string *rs )
+        std::size_t bound() const
         {
-            namespace tm = boost::posix_time;
-            ss_.str(std::string());
-            ss_ << tm::second_clock::local_time();
-            *rs += ss_.str();
+            return text_output_ ? format_->bound(20) : ::checksum::width(algo_);
+        }
+
+        //output size for every value, 0 if it depends on the value
+        std::size_t fixed_size() const
+        {
+            if(!text_output_)
+                return ::checksum::width(algo_);
+
+            static const std::size_t decimal_digits[] = {3, 3, 5, 5, 10};
+            bool hex = format_->conv_ == field_format::hex_lower or format_->conv_ == field_format::hex_upper;
+            return format_->fixed_size(hex ? 2 * ::checksum::width(algo_) : decimal_digits[algo_]);
+        }
+
+        char* operator()( boost::uint32_t value, char *out ) const
+        {
+            if(text_output_)
+                return format_->write_number(value, out);
+
+            for( auto i = ::checksum::width(algo_); i > 0; --i )
+                *out++ = static_cast<char>((value >> ((i - 1) * 8)) & 0xFF);
+            return out;
         }
     };
 
-    struct repeat : public function_base
+    //$seq(format, first, last, name) renders the next number of the counter
+    //"name" of the device as a printf spec. the counter wraps into [first,
+    //last], first defaults to 0 and last to 4294967295.
+    struct seq
     {
-        std::size_t nr_repeats_;
-        char char_;
-        repeat( const common::string_list &list ):
-            function_base(list)
+        common::string_list params_; //the source, kept for message::save
+        boost::shared_ptr<field_format> format_;
+        boost::uint64_t first_, last_;
+        std::size_t slot_;
+
+        static boost::uint64_t number_param( const common::string_list &list, std::size_t pos, boost::uint64_t def )
         {
-            if(list.size() < 2)
-                throw std::string("arity error: repeat function needs two argument");
+            if(list.size() <= pos or list[pos].empty())
+                return def;
 
-            std::stringstream ss(list[0]);
-            std::size_t ascii_code;
-            if( ss >> ascii_code )
-                char_ = (char)(ascii_code);
-            else
-                char_ = list[0][0];
+            std::stringstream ss(list[pos]);
+            boost::uint64_t n;
+            if(!(ss >> n) or !ss.eof())
+                throw std::string("argument error: seq needs a number, got ") + list[pos];
+            return n;
+        }
+
+        seq( const common::string_list &list ):
+            params_(list)
+        {
+            if(list.size() < 1)
+                throw std::string("arity error: seq function needs at least one argument");
+
+            format_ = boost::make_shared<field_format>(list[0]);
+            first_ = number_param(list, 1, 0);
+            last_ = number_param(list, 2, 0xFFFFFFFFu);
+            if(last_ < first_)
+                throw std::string("argument error: seq range is empty");
+            slot_ = sequence_counters::slot(list.size() > 3 ? list[3] : std::string());
+        }
 
-            ss.str(list[1]);
-            if(!(ss >> nr_repeats_))
-                throw std::string("argument error: function repeat needs a numeric argument at 2nd position");            
+        //digits of the widest number in the given base
+        std::size_t digits( unsigned base ) const
+        {
+            std::size_t n = 1;
+            for( auto last = last_; last >= base; last /= base )
+                ++n;
+            return n;
         }
 
-        virtual void operator()( std::string *rs )
+        char* operator()( const context::impl &ctx, char *out ) const
         {
-            for( auto i = 0; i < nr_repeats_; ++i )
-                *rs += char_;
+            if(!ctx.counters_)
+                throw std::string("no sequence counters in the context for $seq");
+            auto n = ctx.counters_->next(slot_);
+            //the full 64 bit range has no span that fits, the counter wraps by itself
+            if(last_ - first_ != boost::uint64_t(-1))
+                n = first_ + n % (last_ - first_ + 1);
+            return format_->write_number(n, out);
         }
     };
 
 }
 
-//return a value calculated by a build in function like i.e. now or repeat
-//the input parameter is ignored
-//--------------------------------------------------------------------------------
+//the compiled form of a message: ops and the tables they refer to
 
-struct functional : public fragment
+struct message::impl
 {
-    typedef boost::function <  functions::function_base*( const common::string_list &list ) > factory_type;        
-    typedef boost::unordered_map< std::string, factory_type > functions_map_type;
-   
-    static functions_map_type functions_map_;
+    std::string name_;
+    common::string_list keys_; //index is the slot of the key
 
-    static bool init_map()
+    std::vector<op> ops_;
+    std::string pool_;
+    std::vector<field_format> formats_;
+    std::vector<functions::now> stamps_;
+    std::vector<functions::seq> seqs_;
+    functions::checksum sum_;
+    bool has_sum_;
+    std::vector< ::checksum::segment> segments_; //summed literals, prepared once
+    std::size_t literal_bytes_; //size of all literal ops
+    std::size_t static_bound_; //literals, repeats and the checksum
+
+    //stencil of a fixed-width record: the constant bytes rendered once and
+    //the position of every dynamic op within them, see format_fixed
+    struct patch
     {
-        functions_map_ = { 
-            {"repeat", boost::factory<functions::repeat*>()}, 
-            {"now", boost::factory<functions::now*>()},
-            {"checksum", boost::factory<functions::checksum*>()} 
-        }; 
+        boost::uint32_t op, offset, width;
+    };
 
-        return true;
+    bool fixed_;
+    std::string stencil_;
+    std::vector<patch> patches_;
+    std::vector<patch> sum_steps_; //the summed ops within the stencil
+
+    impl():
+        has_sum_(false),
+        literal_bytes_(0),
+        static_bound_(0),
+        fixed_(false)
+    {
+    }
+
+    //upper bound of the output for the given values, exact unless a
+    //generic spec or a sequence number is in it. timestamps are refreshed
+    //here, so the run that follows writes the sizes counted.
+    std::size_t bound( const value_ref *slots, context::impl &ctx ) const
+    {
+        return static_bound_ + refresh_stamps(ctx) + field_bound(slots);
     }
 
-    std::string function_name_;
-    common::string_list params_;
-    boost::shared_ptr<functions::function_base> function_;
+    //size of all timestamps after bringing them up to date
+    std::size_t refresh_stamps( context::impl &ctx ) const
+    {
+        std::size_t size = 0;
+        for( const auto &stamp: stamps_ )
+            size += stamp.refresh(ctx).size();
+        return size;
+    }
 
-    functional(const std::string &n, const common::string_list &p):
-        function_name_(n),
-        params_(p)
+    std::size_t field_bound( const value_ref *slots ) const
     {
-        auto itr = functions_map_.find(function_name_);
-        if(itr == functions_map_.end())
-            throw std::string("no such function: ") + function_name_; 
-        function_.reset( itr->second(params_) );
+        std::size_t size = 0;
+        for( const auto &o: ops_ )
+        {
+            if(o.code == op_field)
+                size += formats_[o.b].written_size(slots[o.a].data, slots[o.a].size);
+        }
+        return size;
     }
 
-    virtual void value( const input*, std::string *value ) const    
+    void add_literal( const std::string &bytes )
     {
-        (*function_)(value);
+        if(bytes.empty())
+            return;
+        op o = {op_literal, 0, 0, boost::uint32_t(pool_.size()), boost::uint32_t(bytes.size())};
+        pool_ += bytes;
+        ops_.push_back(o);
     }
 
+    static void parse( impl &imp, const std::string &format);
+    static void fold_constants( impl &imp );
+    static void resolve_checksum( impl &imp );
+    static void prepare_segments( impl &imp );
+    static void compute_bound( impl &imp );
+    static void compute_stencil( impl &imp );
+    static void link( impl &imp );
 };
 
-functional::functions_map_type functional::functions_map_;// = functional::functions_map_type();
-static bool initialized = functional::init_map();
+//build in functions like i.e. now or repeat are compiled into an op, the
+//map holds the compiler of each function
+//--------------------------------------------------------------------------------
 
-struct message::impl
+namespace functions
 {
-    std::string name_;
-    std::vector<fragment::pointer> fragment_vector_;
+    typedef boost::function< void( message::impl &imp, const common::string_list &list ) > compiler_type;
+    typedef boost::unordered_map< std::string, compiler_type > functions_map_type;
 
-    static void parse( impl &imp, const std::string &format);
-};
+    void compile_repeat( message::impl &imp, const common::string_list &list )
+    {
+        if(list.size() < 2)
+            throw std::string("arity error: repeat function needs two argument");
+
+        char c;
+        std::stringstream ss(list[0]);
+        std::size_t ascii_code;
+        if( ss >> ascii_code )
+            c = (char)(ascii_code);
+        else if(!list[0].empty())
+            c = list[0][0];
+        else
+            throw std::string("argument error: function repeat needs a character at 1st position");
+
+        std::stringstream count(list[1]);
+        std::size_t nr_repeats;
+        if(!(count >> nr_repeats))
+            throw std::string("argument error: function repeat needs a numeric argument at 2nd position");            
+
+        op o = {op_repeat, 0, 0, boost::uint32_t((unsigned char)c), boost::uint32_t(nr_repeats)};
+        imp.ops_.push_back(o);
+    }
+
+    void compile_now( message::impl &imp, const common::string_list &list )
+    {
+        imp.stamps_.push_back(now(list));
+        op o = {op_now, 0, 0, boost::uint32_t(imp.stamps_.size() - 1), 0};
+        imp.ops_.push_back(o);
+    }
+
+    void compile_checksum( message::impl &imp, const common::string_list &list )
+    {
+        if(imp.has_sum_)
+            throw std::string("only one checksum per message is supported");
+
+        imp.sum_ = checksum(list);
+        imp.has_sum_ = true;
+        op o = {op_checksum, 0, 0, 0, 0};
+        imp.ops_.push_back(o);
+    }
+
+    void compile_seq( message::impl &imp, const common::string_list &list )
+    {
+        imp.seqs_.push_back(seq(list));
+        op o = {op_seq, 0, 0, boost::uint32_t(imp.seqs_.size() - 1), 0};
+        imp.ops_.push_back(o);
+    }
+
+    const functions_map_type functions_map_ = {
+        {"repeat", compile_repeat},
+        {"now", compile_now},
+        {"checksum", compile_checksum},
+        {"seq", compile_seq}
+    };
+}
 
 //\$START: $(id:%2.2d)\\ $now(%H%M%Y)01$(charge:%04.4d) \
 // $(create)$repeat( ,12)$checksum(%2.2X,int)
 
-//fragment buffer is used to add items to the object tree, built by the
+//fragment buffer is used to add ops to the program, built by the
 //parser algorithm
 //--------------------------------------------------------------------------------
 
 struct fragment_buffer
 {
-    std::vector<fragment::pointer>& vec;
+    message::impl &imp;
     common::string_list param_vec;
     std::string format, buffer, param, ascii_code;
 
-    fragment_buffer( std::vector<fragment::pointer> &p ):
-        vec(p)
+    fragment_buffer( message::impl &i ):
+        imp(i)
     {
 
     }
@@ -250,20 +874,34 @@ struct fragment_buffer
 
     void shift_literal()
     {
-        vec.push_back( boost::make_shared<literal>(buffer) );
+        imp.add_literal(buffer);
         buffer.clear();
     }
 
     void shift_function()
     {
-        vec.push_back( boost::make_shared<functional>(buffer, param_vec));
-        param.clear();
+        if(!param.empty() or !param_vec.empty())
+            shift_param();
+
+        auto itr = functions::functions_map_.find(buffer);
+        if(itr == functions::functions_map_.end())
+            throw std::string("no such function: ") + buffer; 
+        itr->second(imp, param_vec);
+
+        param_vec.clear();
         buffer.clear();
     }
 
     void shift_field()
     {
-        vec.push_back( boost::make_shared<field>(buffer, format));
+        auto &keys = imp.keys_;
+        std::size_t slot = std::find(keys.begin(), keys.end(), buffer) - keys.begin();
+        if(slot == keys.size())
+            keys.push_back(buffer);
+
+        imp.formats_.push_back(field_format(format));
+        op o = {op_field, 0, 0, boost::uint32_t(slot), boost::uint32_t(imp.formats_.size() - 1)};
+        imp.ops_.push_back(o);
         buffer.clear();
         format.clear();
     }
@@ -272,7 +910,7 @@ struct fragment_buffer
     {
         std::stringstream ss(ascii_code);
         std::size_t ascii;
-        if((ss >> ascii) && (ascii < 127) )
+        if((ss >> ascii) && (ascii < 256) )
         {            
             buffer += (char)ascii;
             ascii_code.clear();
@@ -291,7 +929,7 @@ void message::impl::parse(message::impl &imp, const std::string &format )
     auto itr = format.begin();
     auto nd = format.end();
     states state = sstart;
-    fragment_buffer buffer(imp.fragment_vector_);
+    fragment_buffer buffer(imp);
     
 
     for(; itr != nd; ++itr )
@@ -306,6 +944,7 @@ void message::impl::parse(message::impl &imp, const std::string &format )
                         break;
                     case '#':
                         state = ascii_code;
+                        break;
                     case '$':
                         state = scommand;
                         break;
@@ -320,7 +959,7 @@ void message::impl::parse(message::impl &imp, const std::string &format )
                 {
                     case ';':
                         buffer.apply_ascii_code();
-                        state = sstart;
+                        state = sliteral;
                         break;
                     default:
                         buffer.ascii_code += *itr;
@@ -355,6 +994,9 @@ void message::impl::parse(message::impl &imp, const std::string &format )
                     case '\\':
                         state = sesc;
                         break;
+                    case '#':
+                        state = ascii_code;
+                        break;
                     default:
                         buffer += *itr;
                         break;
@@ -378,7 +1020,6 @@ void message::impl::parse(message::impl &imp, const std::string &format )
                 switch(*itr)
                 {
                     case '(': //open bracet after a name means function call
-                        std::cout << "function" << std::endl;
                         state = sparam_list;
                         break;
                     default:
@@ -407,7 +1048,8 @@ void message::impl::parse(message::impl &imp, const std::string &format )
                     case ':':
                         state = sfield_format;
                         break;
-                    case ')':
+                    case ')': //no format, the value is taken as it is
+                        buffer.shift_field();
                         state = sstart;
                         break;
                     default:
@@ -428,25 +1070,1144 @@ void message::impl::parse(message::impl &imp, const std::string &format )
         }
         
     }
+
+    switch(state)
+    {
+        case sstart:
+        case sliteral:
+            if(!buffer.buffer.empty())
+                buffer.shift_literal();
+            break;
+        default:
+            throw std::string("unterminated field, function or ascii code in: ") + format;
+    }
 }
 
 
-message::message( const std::string &name, const std::string &format ):
-    pimpl_(new impl())
+//evaluates the constant ops and merges them with all adjacent literals, so
+//a message becomes a few literal blocks and the dynamic ops between them.
+//the pool is rebuilt and keeps only the merged blocks.
+void message::impl::fold_constants( message::impl &imp )
 {
-    message::impl::parse(*pimpl_, format);
-}
+    std::vector<op> folded;
+    std::string pool, pending;
 
-std::string message::format( const input *inp )
-{
-    //std::stringstream ss;
-    std::string result;
-    for( auto &val : pimpl_->fragment_vector_)
+    auto flush = [&]() {
+        if(pending.empty())
+            return;
+        op o = {op_literal, 0, 0, boost::uint32_t(pool.size()), boost::uint32_t(pending.size())};
+        pool += pending;
+        folded.push_back(o);
+        pending.clear();
+    };
+
+    for( const auto &o: imp.ops_ )
     {
-        val->value(inp, &result);
-        //ss << val->value(inp);
+        switch(o.code)
+        {
+            case op_literal:
+                pending.append(imp.pool_, o.a, o.b);
+                break;
+            case op_repeat:
+                pending.append(o.b, static_cast<char>(o.a));
+                break;
+            default:
+                flush();
+                folded.push_back(o);
+                break;
+        }
     }
 
+    flush();
+    imp.ops_.swap(folded);
+    imp.pool_.swap(pool);
+}
+
+//marks the ops of the checksummed region. literals that contain the skip
+//or stop byte are split there, so every op is either completely inside or
+//outside of the region. splitting only divides the pool range of the op.
+void message::impl::resolve_checksum( message::impl &imp )
+{
+    if(!imp.has_sum_)
+        return;
+
+    auto &ops = imp.ops_;
+    const auto &sum = imp.sum_;
+    std::size_t end = 0;
+    while(ops[end].code != op_checksum)
+        ++end;
+
+    auto split = [&]( std::size_t i, std::size_t at ) {
+        op tail = ops[i];
+        tail.summed = 0;
+        tail.a += at;
+        tail.b -= at;
+        ops[i].b = at;
+        ops.insert(ops.begin() + i + 1, tail);
+    };
+
+    std::size_t begin = 0;
+    if(sum.skip_ >= 0 and end > 0 and ops[0].code == op_literal 
+            and (unsigned char)imp.pool_[ops[0].a] == sum.skip_)
+    {
+        if(ops[0].b > 1)
+        {
+            split(0, 1);
+            ++end;
+        }
+        begin = 1;
+    }
+
+    for( std::size_t i = begin; i < end; ++i )
+    {
+        ops[i].summed = 1;
+        if(ops[i].code != op_literal or sum.stop_ < 0)
+            continue;
+
+        auto pos = imp.pool_.find((char)sum.stop_, ops[i].a);
+        if(pos == std::string::npos or pos >= ops[i].a + ops[i].b)
+            continue;
+
+        pos -= ops[i].a;
+        if(pos + 1 < ops[i].b)
+            split(i, pos + 1);
+        break;
+    }
+}
+
+//the contribution of every summed literal is prepared here, format folds
+//it into the running checksum without reading the bytes
+void message::impl::prepare_segments( message::impl &imp )
+{
+    imp.segments_.clear();
+    for( auto &o: imp.ops_ )
+    {
+        if(o.code != op_literal or !o.summed)
+            continue;
+        if(imp.segments_.size() > 0xFFFF)
+            throw std::string("too many checksummed literals in message ") + imp.name_;
+        o.segment = static_cast<boost::uint16_t>(imp.segments_.size());
+        imp.segments_.push_back(::checksum::segment(imp.sum_.algo_, imp.pool_.data() + o.a, o.b));
+    }
+}
+
+//output of the interpreter. constant bytes are handed over by reference,
+//dynamic bytes are written at the cursor returned by dynamic() and then
+//recorded with commit(). the space was reserved from the size bound, so
+//the writers never check or grow the buffer.
+
+struct string_sink
+{
+    char *pos;
+
+    void constant( const char *data, std::size_t size ) { std::memcpy(pos, data, size); pos += size; }
+    char* dynamic() { return pos; }
+    void commit( char *end ) { pos = end; }
+};
+
+struct gather_sink
+{
+    gather_list &out;
+    char *base, *pos;
+
+    void constant( const char *data, std::size_t size ) { out.append_ref(data, size); }
+    char* dynamic() { return pos; }
+    void commit( char *end ) { out.commit(pos - base, end - pos); pos = end; }
+};
+
+//writes like string_sink and records where the output of every op ends
+struct recording_sink
+{
+    char *base, *pos;
+    std::vector<std::size_t> &ends;
+
+    void constant( const char *data, std::size_t size ) 
+    { 
+        std::memcpy(pos, data, size); 
+        pos += size; 
+        ends.push_back(pos - base);
+    }
+    char* dynamic() { return pos; }
+    void commit( char *end ) { pos = end; ends.push_back(pos - base); }
+};
+
+//the interpreter. with gcc every handler jumps straight to the handler of
+//the next op through a table of label addresses, so each handler has its
+//own indirect branch to predict. the op records stay free of pointers, the
+//table is indexed by the op code. other compilers run a switch loop.
+#if defined(__GNUC__) && !defined(COMPOSER_SWITCH_DISPATCH)
+#define COMPOSER_THREADED_DISPATCH 1
+#define COMPOSER_OP(name) do_##name:
+#define COMPOSER_NEXT() do { if(++ip == last) return; goto *labels[ip->code]; } while(0)
+#else
+#define COMPOSER_OP(name) case op_##name:
+#define COMPOSER_NEXT() continue
+#endif
+
+template<typename Sink>
+void run( const message::impl &imp, run_context &ctx, Sink &sink )
+{
+    const char *pool = imp.pool_.data();
+    const op *ip = imp.ops_.data(), *last = ip + imp.ops_.size();
+    char *from, *end;
+    if(ip == last)
+        return;
+
+#ifdef COMPOSER_THREADED_DISPATCH
+    static const void *const labels[] = {
+        &&do_literal, &&do_field, &&do_repeat, &&do_now, &&do_checksum, &&do_seq
+    };
+    goto *labels[ip->code];
+    {
+#else
+    for(; ip != last; ++ip )
+    switch(ip->code)
+    {
+#endif
+        COMPOSER_OP(literal)
+            sink.constant(pool + ip->a, ip->b);
+            if(ip->summed)
+                ctx.sum.append(imp.segments_[ip->segment]);
+            COMPOSER_NEXT();
+
+        COMPOSER_OP(field)
+            from = sink.dynamic();
+            end = imp.formats_[ip->b].write(ctx.slots[ip->a].data, ctx.slots[ip->a].size, from);
+            goto dynamic_done;
+
+        COMPOSER_OP(repeat)
+            from = sink.dynamic();
+            end = detail::pad(from, static_cast<char>(ip->a), ip->b);
+            goto dynamic_done;
+
+        COMPOSER_OP(now)
+        {
+            const auto &stamp = imp.stamps_[ip->a].cached(ctx.cache);
+            from = sink.dynamic();
+            end = detail::copy(from, stamp.data(), stamp.size());
+            goto dynamic_done;
+        }
+
+        COMPOSER_OP(checksum)
+            from = sink.dynamic();
+            end = imp.sum_(ctx.sum.value(), from);
+            goto dynamic_done;
+
+        COMPOSER_OP(seq)
+            from = sink.dynamic();
+            end = imp.seqs_[ip->a](ctx.cache, from);
+            goto dynamic_done;
+
+        dynamic_done:
+            if(ip->summed)
+                ctx.sum.update(from, end - from);
+            sink.commit(end);
+            COMPOSER_NEXT();
+    }
+}
+
+#undef COMPOSER_OP
+#undef COMPOSER_NEXT
+
+message::message( const std::string &name, const std::string &format ):
+    pimpl_(new impl())
+{
+    pimpl_->name_ = name;
+    message::impl::parse(*pimpl_, format);
+    message::impl::fold_constants(*pimpl_);
+    message::impl::resolve_checksum(*pimpl_);
+    message::impl::link(*pimpl_);
+}
+
+message::message( const boost::shared_ptr<impl> &imp ):
+    pimpl_(imp)
+{
+}
+
+//everything derived from the ops, done after compiling or loading
+void message::impl::link( message::impl &imp )
+{
+    prepare_segments(imp);
+    compute_bound(imp);
+    compute_stencil(imp);
+}
+
+const common::string_list& message::keys() const
+{
+    return pimpl_->keys_;
+}
+
+const std::string& message::name() const
+{
+    return pimpl_->name_;
+}
+
+//the input interface is looked up once per key and call, then the slot
+//based path is taken
+namespace
+{
+    struct resolved_input
+    {
+        common::string_list values_;
+        std::vector<value_ref> slots_;
+
+        resolved_input( const input *inp, const common::string_list &keys )
+        {
+            values_.reserve(keys.size());
+            for( const auto &key: keys )
+                values_.push_back((*inp)[key]);
+            for( const auto &v: values_ )
+                slots_.push_back(value_ref{v.data(), v.size()});
+        }
+    };
+}
+
+std::string message::format( const input *inp, context *ctx ) const
+{
+    resolved_input ri(inp, pimpl_->keys_);
+    return format(ri.slots_.data(), ri.slots_.size(), ctx);
+}
+
+void message::format( const input *inp, gather_list *out, context *ctx ) const
+{
+    resolved_input ri(inp, pimpl_->keys_);
+    format(ri.slots_.data(), ri.slots_.size(), out, ctx);
+}
+
+namespace
+{
+    context::impl& resolve( context *ctx )
+    {
+        return (ctx ? *ctx : context::local()).state();
+    }
+
+    //the values were checked and the space reserved by the caller
+    std::size_t write( const message::impl &imp, const value_ref *slots, char *buffer, 
+            const context::impl &cache )
+    {
+        run_context ctx{slots, ::checksum::state(imp.sum_.algo_), cache};
+        string_sink sink{buffer};
+        run(imp, ctx, sink);
+        return sink.pos - buffer;
+    }
+}
+
+void message::impl::compute_bound( message::impl &imp )
+{
+    imp.literal_bytes_ = imp.static_bound_ = 0;
+    for( const auto &o: imp.ops_ )
+    {
+        if(o.code == op_literal)
+            imp.literal_bytes_ += o.b;
+        else if(o.code == op_repeat)
+            imp.static_bound_ += o.b;
+        else if(o.code == op_seq)
+            imp.static_bound_ += imp.seqs_[o.a].format_->bound(20);
+    }
+    imp.static_bound_ += imp.literal_bytes_;
+    if(imp.has_sum_)
+        imp.static_bound_ += imp.sum_.bound();
+}
+
+std::size_t message::size_bound( const value_ref *slots, std::size_t count, context *ctx ) const
+{
+    if(count < pimpl_->keys_.size())
+        throw std::string("too few field values for message ") + pimpl_->name_;
+    return pimpl_->bound(slots, resolve(ctx));
+}
+
+std::string message::format( const value_ref *slots, std::size_t count, context *ctx ) const
+{
+    auto &cache = resolve(ctx);
+    std::string result(size_bound(slots, count, ctx), '\0');
+    result.resize(write(*pimpl_, slots, &result[0], cache));
+    return result;
+}
+
+std::size_t message::format( const value_ref *slots, std::size_t count, char *buffer, 
+        std::size_t capacity, context *ctx ) const
+{
+    auto &cache = resolve(ctx);
+    if(capacity < size_bound(slots, count, ctx))
+        throw std::string("output buffer too small for message ") + pimpl_->name_;
+    return write(*pimpl_, slots, buffer, cache);
+}
+
+void message::format( const input *inp, output_buffer *out, context *ctx ) const
+{
+    resolved_input ri(inp, pimpl_->keys_);
+    format(ri.slots_.data(), ri.slots_.size(), out, ctx);
+}
+
+void message::format( const value_ref *slots, std::size_t count, output_buffer *out, context *ctx ) const
+{
+    auto &cache = resolve(ctx);
+    auto size = size_bound(slots, count, ctx);
+    out->reset(); //a single handle that is reused takes the same buffer again
+    *out = output_buffer(size);
+    out->resize(write(*pimpl_, slots, out->data(), cache));
+}
+
+//batches
+//--------------------------------------------------------------------------------
+//rows are sized first, all rows share one refresh of the timestamps. a
+//serial batch writes the rows back to back. a parallel batch cuts the rows
+//into chunks, each chunk writes its rows packed from the offset its bound
+//prefix reserves, so chunks never overlap. the gaps left by the bounds are
+//closed by moving every chunk down when all of them are done.
+
+namespace
+{
+    const std::size_t min_chunk_rows = 64;
+
+    struct batch_chunk
+    {
+        std::size_t first, last; //rows
+        std::size_t begin, end; //bytes written
+    };
+
+    //the chunks of a parallel batch wait for each other with a counter
+    struct batch_latch
+    {
+        boost::mutex mutex_;
+        boost::condition_variable done_;
+        std::size_t pending_;
+        std::string error_;
+        std::exception_ptr failure_; //any other exception of a chunk
+
+        void finish( const std::string &error, std::exception_ptr failure = std::exception_ptr() )
+        {
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            if(error_.empty())
+                error_ = error;
+            if(!failure_)
+                failure_ = failure;
+            if(--pending_ == 0)
+                done_.notify_one();
+        }
+
+        void wait()
+        {
+            boost::unique_lock<boost::mutex> lock(mutex_);
+            while(pending_)
+                done_.wait(lock);
+        }
+    };
+
+    //chunks running on the pool read the timestamps from the context of the
+    //calling thread, which waits for them
+    void write_rows( const message::impl &imp, const context::impl &cache, const value_ref *rows, 
+            std::size_t stride, batch_chunk &chunk, char *buffer, std::size_t *offsets )
+    {
+        chunk.end = chunk.begin;
+        for( auto i = chunk.first; i < chunk.last; ++i )
+        {
+            offsets[i] = chunk.end;
+            chunk.end += write(imp, rows + i * stride, buffer + chunk.end, cache);
+        }
+    }
+}
+
+std::size_t message::batch_bound( const value_ref *rows, std::size_t count, context *ctx ) const
+{
+    const auto &imp = *pimpl_;
+    auto stride = imp.keys_.size();
+    auto size = count * (imp.static_bound_ + imp.refresh_stamps(resolve(ctx)));
+    for( std::size_t i = 0; i < count; ++i )
+        size += imp.field_bound(rows + i * stride);
+    return size;
+}
+
+std::size_t message::format_batch( const value_ref *rows, std::size_t count, char *buffer, std::size_t capacity, 
+        std::size_t *offsets, boost::asio::thread_pool *pool, context *ctx ) const
+{
+    const auto &imp = *pimpl_;
+    const auto &cache = resolve(ctx);
+    auto stride = imp.keys_.size();
+    auto fixed = imp.static_bound_ + imp.refresh_stamps(resolve(ctx));
+
+    std::vector<batch_chunk> chunks;
+    std::size_t chunk_rows = count;
+    if(pool)
+    {
+        auto threads = std::max(1u, boost::thread::hardware_concurrency());
+        chunk_rows = std::max(min_chunk_rows, (count + 2 * threads - 1) / (2 * threads));
+    }
+
+    std::size_t size = 0;
+    for( std::size_t i = 0; i < count; ++i )
+    {
+        if(i % chunk_rows == 0)
+            chunks.push_back(batch_chunk{i, std::min(count, i + chunk_rows), size, size});
+        size += fixed + imp.field_bound(rows + i * stride);
+    }
+    if(capacity < size)
+        throw std::string("output buffer too small for batch of message ") + imp.name_;
+
+    if(chunks.size() < 2)
+    {
+        for( auto &chunk: chunks )
+            write_rows(imp, cache, rows, stride, chunk, buffer, offsets);
+        offsets[count] = chunks.empty() ? 0 : chunks.back().end;
+        return offsets[count];
+    }
+
+    batch_latch latch;
+    latch.pending_ = chunks.size();
+    for( auto &chunk: chunks )
+    {
+        auto *c = &chunk;
+        boost::asio::post(*pool, [&imp, &cache, rows, stride, c, buffer, offsets, &latch]() {
+            try
+            {
+                write_rows(imp, cache, rows, stride, *c, buffer, offsets);
+                latch.finish(std::string());
+            }
+            catch( const std::string &error )
+            {
+                latch.finish(error);
+            }
+            catch( ... )
+            {
+                latch.finish(std::string(), std::current_exception());
+            }
+        });
+    }
+    latch.wait();
+    if(!latch.error_.empty())
+        throw latch.error_;
+    if(latch.failure_)
+        std::rethrow_exception(latch.failure_);
+
+    std::size_t end = chunks.front().end;
+    for( std::size_t k = 1; k < chunks.size(); ++k )
+    {
+        const auto &chunk = chunks[k];
+        auto shift = chunk.begin - end;
+        std::memmove(buffer + end, buffer + chunk.begin, chunk.end - chunk.begin);
+        for( auto i = chunk.first; i < chunk.last; ++i )
+            offsets[i] -= shift;
+        end += chunk.end - chunk.begin;
+    }
+    offsets[count] = end;
+    return end;
+}
+
+//stencils
+//--------------------------------------------------------------------------------
+//a message is a fixed-width record if every field has a width and the
+//checksum and sequence numbers, if any, have a size independent of their
+//value. timestamps keep the
+//size they had when the message was built. format_fixed copies the stencil
+//and writes each dynamic op over its placeholder, a value that does not
+//render to exactly the width of its placeholder fails the call.
+
+void message::impl::compute_stencil( message::impl &imp )
+{
+    imp.fixed_ = false;
+    imp.stencil_.clear();
+    imp.patches_.clear();
+    imp.sum_steps_.clear();
+
+    for( std::size_t i = 0; i < imp.ops_.size(); ++i )
+    {
+        const auto &o = imp.ops_[i];
+        std::size_t width = 0;
+        switch(o.code)
+        {
+            case op_literal:
+                imp.stencil_.append(imp.pool_, o.a, o.b);
+                break;
+            case op_repeat:
+                imp.stencil_.append(o.b, static_cast<char>(o.a));
+                break;
+            case op_field:
+            {
+                width = imp.formats_[o.b].fixed_width();
+                if(width == 0)
+                    return;
+                break;
+            }
+            case op_now:
+            {
+                context sample;
+                width = imp.stamps_[o.a].refresh(sample.state()).size();
+                break;
+            }
+            case op_checksum:
+                width = imp.sum_.fixed_size();
+                if(width == 0)
+                    return;
+                break;
+            case op_seq:
+            {
+                const auto &sq = imp.seqs_[o.a];
+                bool hex = sq.format_->conv_ == field_format::hex_lower or sq.format_->conv_ == field_format::hex_upper;
+                width = sq.format_->fixed_size(sq.digits(hex ? 16 : 10));
+                if(width == 0)
+                    return;
+                break;
+            }
+        }
+
+        if(o.code == op_literal or o.code == op_repeat)
+            width = o.b;
+        else
+        {
+            imp.patches_.push_back(patch{boost::uint32_t(i), boost::uint32_t(imp.stencil_.size()), boost::uint32_t(width)});
+            imp.stencil_.append(width, ' ');
+        }
+
+        if(o.summed)
+        {
+            auto offset = imp.stencil_.size() - width;
+            imp.sum_steps_.push_back(patch{boost::uint32_t(i), boost::uint32_t(offset), boost::uint32_t(width)});
+        }
+    }
+    imp.fixed_ = true;
+}
+
+bool message::fixed_width() const
+{
+    return pimpl_->fixed_;
+}
+
+std::size_t message::record_size() const
+{
+    return pimpl_->stencil_.size();
+}
+
+std::size_t message::format_fixed( const value_ref *slots, std::size_t count, char *buffer, 
+        std::size_t capacity, context *ctx ) const
+{
+    const auto &imp = *pimpl_;
+    if(!imp.fixed_)
+        throw std::string("message is not a fixed-width record: ") + imp.name_;
+    if(count < imp.keys_.size())
+        throw std::string("too few field values for message ") + imp.name_;
+    if(capacity < imp.stencil_.size())
+        throw std::string("output buffer too small for message ") + imp.name_;
+
+    std::memcpy(buffer, imp.stencil_.data(), imp.stencil_.size());
+    const impl::patch *sum_patch = 0;
+    for( const auto &p: imp.patches_ )
+    {
+        const auto &o = imp.ops_[p.op];
+        char *at = buffer + p.offset, *end = at;
+        switch(o.code)
+        {
+            case op_field:
+            {
+                const auto &f = imp.formats_[o.b];
+                const auto &v = slots[o.a];
+                //the size is checked first, so the value is written straight
+                //into its placeholder and never rendered aside
+                if(f.written_size(v.data, v.size) != p.width)
+                    return 0;
+                end = f.write(v.data, v.size, at);
+                break;
+            }
+            case op_now:
+            {
+                const auto &stamp = imp.stamps_[o.a].refresh(resolve(ctx));
+                if(stamp.size() != p.width)
+                    return 0;
+                end = detail::copy(at, stamp.data(), stamp.size());
+                break;
+            }
+            case op_checksum:
+                sum_patch = &p;
+                end = at + p.width;
+                break;
+            case op_seq:
+                end = imp.seqs_[o.a](resolve(ctx), at);
+                break;
+        }
+        if(std::size_t(end - at) != p.width)
+            return 0;
+    }
+
+    if(sum_patch)
+    {
+        ::checksum::state sum(imp.sum_.algo_);
+        for( const auto &step: imp.sum_steps_ )
+        {
+            const auto &o = imp.ops_[step.op];
+            if(o.code == op_literal)
+                sum.append(imp.segments_[o.segment]);
+            else
+                sum.update(buffer + step.offset, step.width);
+        }
+        imp.sum_(sum.value(), buffer + sum_patch->offset);
+    }
+    return imp.stencil_.size();
+}
+
+void message::format( const value_ref *slots, std::size_t count, gather_list *out, context *ctx ) const
+{
+    auto &cache = resolve(ctx);
+    auto size = size_bound(slots, count, ctx);
+
+    run_context run_ctx{slots, ::checksum::state(pimpl_->sum_.algo_), cache};
+    out->clear();
+    char *scratch = out->scratch(size - pimpl_->literal_bytes_);
+    gather_sink sink{*out, scratch, scratch};
+    run(*pimpl_, run_ctx, sink);
+}
+
+//serialisation
+//--------------------------------------------------------------------------------
+//a saved message is the magic "CMPS", the format version and then the
+//tables of the program: name, keys, literal pool, ops, field specs and the
+//parameters of the functions. integers are little endian. everything that
+//depends on the process (timestamp ids, counter slots) or is derived from
+//the ops (checksum segments, bounds, stencil) is rebuilt by load.
+
+namespace
+{
+    const char magic[4] = {'C', 'M', 'P', 'S'};
+    const boost::uint32_t bytecode_version = 1;
+
+    void put_u32( std::ostream &out, boost::uint32_t v )
+    {
+        char b[4] = {char(v & 0xFF), char((v >> 8) & 0xFF), char((v >> 16) & 0xFF), char(v >> 24)};
+        out.write(b, 4);
+    }
+
+    void put_string( std::ostream &out, const std::string &s )
+    {
+        put_u32(out, boost::uint32_t(s.size()));
+        out.write(s.data(), s.size());
+    }
+
+    void put_list( std::ostream &out, const common::string_list &list )
+    {
+        put_u32(out, boost::uint32_t(list.size()));
+        for( const auto &s: list )
+            put_string(out, s);
+    }
+
+    boost::uint32_t get_u32( std::istream &in )
+    {
+        unsigned char b[4];
+        if(!in.read(reinterpret_cast<char*>(b), 4))
+            throw std::string("bytecode error: unexpected end of stream");
+        return b[0] | (b[1] << 8) | (b[2] << 16) | (boost::uint32_t(b[3]) << 24);
+    }
+
+    //lengths and counts come from a stream that may be damaged, nothing is
+    //sized by them up front. strings are read in bounded chunks and tables
+    //grow with the elements actually read, a short stream fails early.
+    const std::size_t read_chunk = 64 * 1024;
+
+    std::string get_string( std::istream &in )
+    {
+        std::string s;
+        for( std::size_t left = get_u32(in); left; )
+        {
+            auto n = std::min(left, read_chunk);
+            auto at = s.size();
+            s.resize(at + n);
+            if(!in.read(&s[at], n))
+                throw std::string("bytecode error: unexpected end of stream");
+            left -= n;
+        }
+        return s;
+    }
+
+    common::string_list get_list( std::istream &in )
+    {
+        common::string_list list;
+        for( auto n = get_u32(in); n; --n )
+            list.push_back(get_string(in));
+        return list;
+    }
+}
+
+void message::save( std::ostream &out ) const
+{
+    const auto &imp = *pimpl_;
+    out.write(magic, sizeof(magic));
+    put_u32(out, bytecode_version);
+
+    put_string(out, imp.name_);
+    put_list(out, imp.keys_);
+    put_string(out, imp.pool_);
+
+    put_u32(out, boost::uint32_t(imp.ops_.size()));
+    for( const auto &o: imp.ops_ )
+    {
+        put_u32(out, o.code | (o.summed << 8));
+        put_u32(out, o.a);
+        put_u32(out, o.b);
+    }
+
+    put_u32(out, boost::uint32_t(imp.formats_.size()));
+    for( const auto &f: imp.formats_ )
+        put_string(out, f.spec_);
+    put_u32(out, boost::uint32_t(imp.stamps_.size()));
+    for( const auto &stamp: imp.stamps_ )
+        put_list(out, stamp.params_);
+    put_u32(out, boost::uint32_t(imp.seqs_.size()));
+    for( const auto &sq: imp.seqs_ )
+        put_list(out, sq.params_);
+    put_u32(out, imp.has_sum_ ? 1 : 0);
+    if(imp.has_sum_)
+        put_list(out, imp.sum_.params_);
+
+    if(!out)
+        throw std::string("bytecode error: could not write message ") + imp.name_;
+}
+
+message message::load( std::istream &in )
+{
+    char head[4];
+    if(!in.read(head, 4) or std::memcmp(head, magic, 4) or get_u32(in) != bytecode_version)
+        throw std::string("bytecode error: not a compiled message of this version");
+
+    auto imp = boost::make_shared<impl>();
+    imp->name_ = get_string(in);
+    imp->keys_ = get_list(in);
+    imp->pool_ = get_string(in);
+
+    for( auto n = get_u32(in); n; --n )
+    {
+        auto code = get_u32(in);
+        op o;
+        o.code = code & 0xFF;
+        o.summed = (code >> 8) & 0xFF;
+        o.segment = 0;
+        o.a = get_u32(in);
+        o.b = get_u32(in);
+        imp->ops_.push_back(o);
+    }
+
+    for( auto n = get_u32(in); n; --n )
+        imp->formats_.push_back(field_format(get_string(in)));
+    for( auto n = get_u32(in); n; --n )
+        imp->stamps_.push_back(functions::now(get_list(in)));
+    for( auto n = get_u32(in); n; --n )
+        imp->seqs_.push_back(functions::seq(get_list(in)));
+    if(get_u32(in))
+    {
+        imp->sum_ = functions::checksum(get_list(in));
+        imp->has_sum_ = true;
+    }
+
+    //a damaged program must not index past its tables
+    for( const auto &o: imp->ops_ )
+    {
+        bool valid = false;
+        switch(o.code)
+        {
+            case op_literal: valid = o.a <= imp->pool_.size() and o.b <= imp->pool_.size() - o.a; break;
+            case op_field: valid = o.a < imp->keys_.size() and o.b < imp->formats_.size(); break;
+            case op_repeat: break; //folded into literals, never saved
+            case op_now: valid = o.a < imp->stamps_.size(); break;
+            case op_checksum: valid = imp->has_sum_; break;
+            case op_seq: valid = o.a < imp->seqs_.size(); break;
+        }
+        if(!valid)
+            throw std::string("bytecode error: inconsistent program in message ") + imp->name_;
+    }
+
+    message::impl::link(*imp);
+    return message(imp);
+}
+
+//recomposition
+//--------------------------------------------------------------------------------
+
+class recomposer::impl
+{
+    public:
+        message msg_;
+        std::string output_;
+        std::vector<std::size_t> ends_; //end of the output of every op
+        common::string_list values_; //values of the last call, by slot
+        std::vector<char> changed_;
+        std::string fragment_;
+        std::size_t rendered_;
+
+        impl( const message &msg ):
+            msg_(msg),
+            rendered_(0)
+        {
+        }
+
+        void render_all( const message::impl &imp, const value_ref *slots, context::impl &cache )
+        {
+            auto bound = imp.bound(slots, cache);
+            output_.resize(bound);
+            ends_.clear();
+            run_context ctx{slots, ::checksum::state(imp.sum_.algo_), cache};
+            recording_sink sink{&output_[0], &output_[0], ends_};
+            run(imp, ctx, sink);
+            output_.resize(sink.pos - sink.base);
+            rendered_ = imp.ops_.size();
+
+            values_.resize(imp.keys_.size());
+            for( std::size_t i = 0; i < values_.size(); ++i )
+                values_[i].assign(slots[i].data, slots[i].size);
+
+            //the scratch of update is sized here, so updates with values of
+            //no more than these sizes do not allocate
+            changed_.reserve(values_.size());
+            fragment_.reserve(bound);
+        }
+
+        //replaces the output of op i with fragment_
+        void patch( std::size_t i )
+        {
+            auto begin = i ? ends_[i - 1] : 0;
+            auto size = ends_[i] - begin;
+            if(fragment_.size() == size)
+                std::memcpy(&output_[begin], fragment_.data(), size);
+            else
+            {
+                output_.replace(begin, size, fragment_);
+                for( auto k = i; k < ends_.size(); ++k )
+                    ends_[k] = ends_[k] + fragment_.size() - size;
+            }
+            ++rendered_;
+        }
+
+        void update( const message::impl &imp, const value_ref *slots, context::impl &cache )
+        {
+            changed_.assign(values_.size(), 0);
+            for( std::size_t i = 0; i < values_.size(); ++i )
+            {
+                const auto &v = values_[i];
+                if(v.size() != slots[i].size or std::memcmp(v.data(), slots[i].data, v.size()))
+                {
+                    changed_[i] = 1;
+                    values_[i].assign(slots[i].data, slots[i].size);
+                }
+            }
+
+            rendered_ = 0;
+            std::size_t sum_op = imp.ops_.size();
+            for( std::size_t i = 0; i < imp.ops_.size(); ++i )
+            {
+                const auto &o = imp.ops_[i];
+                switch(o.code)
+                {
+                    case op_field:
+                    {
+                        if(!changed_[o.a])
+                            continue;
+                        const auto &f = imp.formats_[o.b];
+                        fragment_.resize(f.bound(slots[o.a].size));
+                        fragment_.resize(f.write(slots[o.a].data, slots[o.a].size, &fragment_[0]) - fragment_.data());
+                        break;
+                    }
+                    case op_now:
+                        fragment_ = imp.stamps_[o.a].refresh(cache);
+                        break;
+                    case op_seq:
+                    {
+                        const auto &sq = imp.seqs_[o.a];
+                        fragment_.resize(sq.format_->bound(20));
+                        fragment_.resize(sq(cache, &fragment_[0]) - fragment_.data());
+                        break;
+                    }
+                    case op_checksum:
+                        sum_op = i;
+                        continue;
+                    default:
+                        continue;
+                }
+                patch(i);
+            }
+
+            if(sum_op == imp.ops_.size())
+                return;
+
+            ::checksum::state sum(imp.sum_.algo_);
+            for( std::size_t i = 0; i < imp.ops_.size(); ++i )
+            {
+                const auto &o = imp.ops_[i];
+                if(!o.summed)
+                    continue;
+                if(o.code == op_literal)
+                    sum.append(imp.segments_[o.segment]);
+                else
+                {
+                    auto begin = i ? ends_[i - 1] : 0;
+                    sum.update(output_.data() + begin, ends_[i] - begin);
+                }
+            }
+            fragment_.resize(imp.sum_.bound());
+            fragment_.resize(imp.sum_(sum.value(), &fragment_[0]) - fragment_.data());
+            patch(sum_op);
+        }
+};
+
+recomposer::recomposer( const message &msg ):
+    pimpl_(new impl(msg))
+{
+}
+
+const std::string& recomposer::format( const value_ref *slots, std::size_t count, context *ctx )
+{
+    const auto &imp = *pimpl_->msg_.pimpl_;
+    if(count < imp.keys_.size())
+        throw std::string("too few field values for message ") + imp.name_;
+
+    auto &cache = resolve(ctx);
+    if(pimpl_->ends_.empty())
+        pimpl_->render_all(imp, slots, cache);
+    else
+        pimpl_->update(imp, slots, cache);
+    return pimpl_->output_;
+}
+
+void recomposer::reset()
+{
+    pimpl_->output_.clear();
+    pimpl_->ends_.clear();
+}
+
+std::size_t recomposer::rendered() const
+{
+    return pimpl_->rendered_;
+}
+
+//--------------------------------------------------------------------------------
+
+sequence_counters::sequence_counters( std::size_t size ):
+    size_(size),
+    counters_(new std::atomic<boost::uint64_t>[size])
+{
+    for( std::size_t i = 0; i < size_; ++i )
+        counters_[i].store(0, std::memory_order_relaxed);
+}
+
+std::size_t sequence_counters::slot( const std::string &name )
+{
+    static boost::mutex mutex;
+    static boost::unordered_map<std::string, std::size_t> slots;
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return slots.emplace(name, slots.size()).first->second;
+}
+
+boost::uint64_t sequence_counters::next( std::size_t slot )
+{
+    if(slot >= size_)
+        throw std::string("sequence counter slot out of range");
+    return counters_[slot].fetch_add(1, std::memory_order_relaxed);
+}
+
+void sequence_counters::set( std::size_t slot, boost::uint64_t value )
+{
+    if(slot >= size_)
+        throw std::string("sequence counter slot out of range");
+    counters_[slot].store(value, std::memory_order_relaxed);
+}
+
+//--------------------------------------------------------------------------------
+
+context::context():
+    pimpl_(new impl())
+{
+}
+
+context::impl& context::state() const
+{
+    return *pimpl_;
+}
+
+void context::counters( sequence_counters *seq )
+{
+    pimpl_->counters_ = seq;
+}
+
+sequence_counters* context::counters() const
+{
+    return pimpl_->counters_;
+}
+
+context& context::local()
+{
+    static thread_local context ctx;
+    return ctx;
+}
+
+//--------------------------------------------------------------------------------
+
+gather_list::gather_list():
+    bytes_(0)
+{
+}
+
+void gather_list::clear()
+{
+    pieces_.clear();
+    iov_.clear();
+    scratch_.clear();
+    bytes_ = 0;
+}
+
+void gather_list::append_ref( const char *data, std::size_t size )
+{
+    if(size == 0)
+        return;
+    pieces_.push_back(piece{data, 0, size});
+    bytes_ += size;
+}
+
+char* gather_list::scratch( std::size_t size )
+{
+    scratch_.resize(size);
+    return &scratch_[0];
+}
+
+void gather_list::commit( std::size_t from, std::size_t size )
+{
+    if(size == 0)
+        return;
+
+    bytes_ += size;
+    //dynamic fragments written back to back share one entry
+    if(!pieces_.empty() and !pieces_.back().data 
+            and pieces_.back().offset + pieces_.back().size == from)
+    {
+        pieces_.back().size += size;
+        return;
+    }
+    pieces_.push_back(piece{0, from, size});
+}
+
+const iovec* gather_list::iov()
+{
+    iov_.resize(pieces_.size());
+    for( std::size_t i = 0; i < pieces_.size(); ++i )
+    {
+        const auto &p = pieces_[i];
+        const char *base = p.data ? p.data : scratch_.data() + p.offset;
+        iov_[i].iov_base = const_cast<char*>(base);
+        iov_[i].iov_len = p.size;
+    }
+    return iov_.data();
+}
+
+std::size_t gather_list::count() const
+{
+    return pieces_.size();
+}
+
+std::size_t gather_list::bytes() const
+{
+    return bytes_;
+}
+
+std::string gather_list::str() const
+{
+    std::string result;
+    result.reserve(bytes_);
+    for( const auto &p: pieces_ )
+        result.append(p.data ? p.data : scratch_.data() + p.offset, p.size);
     return result;
 }
 
@@ -2,11 +2,23 @@
 #define __COMPSER_INCLUDE_GUARD_18_16__
 
 #include <string>
+#include <vector>
+#include <iosfwd>
+#include <sys/uio.h>
+#include <atomic>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include "common.hpp"
+
+namespace boost { namespace asio { class thread_pool; } }
 
 namespace composer
 {
 
+class output_buffer; //see buffer_pool.hpp
+
 class input
 {
     public:
@@ -15,14 +27,195 @@ class input
         virtual ~input(){};
 };
 
+//value_ref is a view on one field value owned by the caller
+struct value_ref
+{
+    const char *data;
+    std::size_t size;
+};
+
+//gather_list is the scatter-gather result of message::format, ready to be
+//handed to writev or sendmsg. constant literals are referenced where the
+//message stores them, only dynamic fragments (fields, functions) are
+//written into the scratch buffer of the list. the entries stay valid until
+//the list is formatted again or the message is destroyed. a list is meant
+//to be reused, so its buffers stop growing after a few messages.
+class gather_list
+{
+    struct piece
+    {
+        const char *data; //0 for bytes in scratch_
+        std::size_t offset, size;
+    };
+
+    std::vector<piece> pieces_;
+    std::vector<iovec> iov_;
+    std::string scratch_;
+    std::size_t bytes_;
+
+    public:
+        gather_list();
+
+        void clear();
+
+        //add constant bytes, they are referenced and not copied
+        void append_ref( const char *data, std::size_t size );
+
+        //scratch sizes the buffer for the dynamic bytes once, before they
+        //are written. written bytes are then recorded with commit by their
+        //offset in the scratch buffer.
+        char* scratch( std::size_t size );
+        void commit( std::size_t from, std::size_t size );
+
+        const iovec* iov(); //resolves the entries, call after formatting
+        std::size_t count() const;
+        std::size_t bytes() const;
+        std::string str() const; //contiguous copy of all entries
+};
+
+//sequence_counters are the counters of $seq(format, first, last, name) for
+//one device. every counter name is mapped to a slot once, process wide, when
+//a message using it is compiled. the name may be left out, all messages then
+//share the counter of the empty name. next is a single atomic increment,
+//senders to the same device on several threads get unique numbers without a
+//lock. $seq wraps the counter into [first, last].
+class sequence_counters : boost::noncopyable
+{
+    std::size_t size_;
+    boost::scoped_array<std::atomic<boost::uint64_t> > counters_;
+
+    public:
+        explicit sequence_counters( std::size_t size = 64 );
+
+        static std::size_t slot( const std::string &name );
+
+        //throws a std::string if the slot is not below size
+        boost::uint64_t next( std::size_t slot );
+        void set( std::size_t slot, boost::uint64_t value );
+};
+
+//context holds the mutable state of formatting: the caches of rendered
+//timestamps and the sequence counters of the device the messages go to. a
+//context may only be used by one thread at a time, the counters it points
+//to may be shared. every format call takes an optional context, without one
+//the context of the calling thread is used.
+class context
+{
+    public:
+        class impl;
+
+    private:
+        boost::shared_ptr<impl> pimpl_;
+
+    public:
+        context();
+        impl& state() const;
+
+        //the counters are not owned, formatting a message with $seq throws a
+        //std::string if none are set
+        void counters( sequence_counters *seq );
+        sequence_counters* counters() const;
+
+        static context& local(); //the context of the calling thread
+};
+
+//a compiled message is immutable, format is const and may be called from
+//any number of threads at once.
 class message
 {
+    public:
+        class impl; //the compiled message, see composer.cpp
+
+    private:
+        friend class recomposer;
+        boost::shared_ptr<impl> pimpl_;
+
+        explicit message( const boost::shared_ptr<impl> &imp );
+
+    public:
+        message( const std::string &name, const std::string &format );
+        std::string format( const input *inp, context *ctx = 0 ) const;
+
+        //scatter-gather composition into a reused list, see gather_list
+        void format( const input *inp, gather_list *out, context *ctx = 0 ) const;
+
+        //keys of all fields of the message, each key once in order of its first
+        //appearance. the position of a key is its slot: the caller resolves the
+        //keys once and then passes the values as an array of views indexed by
+        //slot, which skips the lookups of the input interface.
+        const common::string_list& keys() const;
+        const std::string& name() const;
+        std::string format( const value_ref *slots, std::size_t count, context *ctx = 0 ) const;
+        void format( const value_ref *slots, std::size_t count, gather_list *out, context *ctx = 0 ) const;
 
+        //the output never exceeds size_bound of the same values. it is computed
+        //from the compiled ops and the values without rendering anything, and
+        //is the exact output size unless a generic spec or a sequence number
+        //counts its largest. format reserves it once and writes without checks.
+        std::size_t size_bound( const value_ref *slots, std::size_t count, context *ctx = 0 ) const;
+
+        //writes into a caller buffer and returns the bytes written. throws a
+        //std::string if capacity is below size_bound.
+        std::size_t format( const value_ref *slots, std::size_t count, char *buffer, 
+                std::size_t capacity, context *ctx = 0 ) const;
+
+        //writes into a buffer of the pool of the calling thread, sized by
+        //size_bound. the buffer out held before is released first.
+        void format( const input *inp, output_buffer *out, context *ctx = 0 ) const;
+        void format( const value_ref *slots, std::size_t count, output_buffer *out, context *ctx = 0 ) const;
+
+        //formats count rows into one buffer. rows is row major with keys().size()
+        //values per row. offsets receives count + 1 entries, row i is written to
+        //[offsets[i], offsets[i + 1]). returns the bytes written and throws a
+        //std::string if capacity is below batch_bound. with a pool, large batches
+        //are split into chunks that are formatted in parallel, the call returns
+        //when all of them are done.
+        std::size_t batch_bound( const value_ref *rows, std::size_t count, context *ctx = 0 ) const;
+        std::size_t format_batch( const value_ref *rows, std::size_t count, char *buffer, std::size_t capacity, 
+                std::size_t *offsets, boost::asio::thread_pool *pool = 0, context *ctx = 0 ) const;
+
+        //stencil mode for fixed-width records, where every field has a width and
+        //a checksum has a fixed size. the constant layout is rendered once when
+        //the message is built, format_fixed copies it and writes only the fields,
+        //timestamps and the checksum over their placeholders. returns
+        //record_size(), or 0 if a value does not render to exactly the width of
+        //its field. throws a std::string if the message is not fixed-width or
+        //capacity is below record_size().
+        bool fixed_width() const;
+        std::size_t record_size() const;
+        std::size_t format_fixed( const value_ref *slots, std::size_t count, char *buffer, 
+                std::size_t capacity, context *ctx = 0 ) const;
+
+        //the compiled program in a binary form, so a set of messages can be
+        //cached on disk and loaded at startup without parsing format strings.
+        //several messages may be saved to one stream and loaded in order. load
+        //throws a std::string on a read error, a stream of another version or
+        //an inconsistent program.
+        void save( std::ostream &out ) const;
+        static message load( std::istream &in );
+};
+
+//recomposer keeps the last output of one message for one device, for
+//messages that are sent periodically with few changes. format compares the
+//values with those of the last call and renders only the fields whose
+//values changed, $now and $seq are rendered on every call. a fragment of
+//the same size is patched in place, otherwise the rest of the output is
+//moved. the checksum is updated last from the prepared constant parts and
+//the dynamic fragments. a recomposer may only be used by one thread at a
+//time.
+class recomposer
+{
     class impl;
     boost::shared_ptr<impl> pimpl_;
+
     public:
-        message( const std::string &name, const std::string &format );
-        std::string format( const input *inp );
+        explicit recomposer( const message &msg );
+
+        //the returned output stays valid until the next call
+        const std::string& format( const value_ref *slots, std::size_t count, context *ctx = 0 );
+        void reset(); //the next format renders everything
+
+        std::size_t rendered() const; //fragments rendered by the last call
 };
 
 }
@@ -0,0 +1,164 @@
+/*field_writer.hpp
+ *
+ * The hand-written writers of the printf subset of field specs: integers
+ * (d, i, u, x, X) and strings (s) with the flags - 0 + and space, a width
+ * and a precision. The value is a string, integer conversions parse it
+ * first and fall back to string output if it is not a number.
+ * They are shared by the specs compiled when a message is built
+ * (field_format in composer.cpp) and those compiled by the compiler
+ * (static_composer.hpp). The spec is passed as plain parameters, the
+ * compile-time side passes constants and gets a folded writer.
+ * Internal header, not part of the composer interface.
+ * */
+
+#ifndef __FIELD_WRITER_INCLUDE_GUARD_09_14__
+#define __FIELD_WRITER_INCLUDE_GUARD_09_14__
+
+//std
+#include <cstring>
+#include <cstddef>
+
+//boost
+#include <boost/cstdint.hpp>
+
+namespace composer
+{
+
+namespace detail
+{
+
+//strict integer syntax: optional sign and up to 18 digits
+inline bool parse_integer( const char *v, std::size_t size, bool &negative, boost::uint64_t &value )
+{
+    std::size_t pos = 0;
+    negative = false;
+    if(pos < size and (v[pos] == '-' or v[pos] == '+'))
+        negative = v[pos++] == '-';
+
+    if(pos == size or size - pos > 18)
+        return false;
+
+    value = 0;
+    for(; pos < size; ++pos)
+    {
+        if(v[pos] < '0' or v[pos] > '9')
+            return false;
+        value = value * 10 + (v[pos] - '0');
+    }
+    return true;
+}
+
+inline char* pad( char *out, char c, std::size_t n )
+{
+    std::memset(out, c, n);
+    return out + n;
+}
+
+inline char* copy( char *out, const char *data, std::size_t n )
+{
+    std::memcpy(out, data, n);
+    return out + n;
+}
+
+inline std::size_t larger( std::size_t a, std::size_t b )
+{
+    return a > b ? a : b;
+}
+
+//the most bytes write_value can produce for a value of the given size. for
+//integers the digits of the largest parsed value are assumed.
+inline std::size_t value_bound( bool integer, std::size_t width, int precision, std::size_t size )
+{
+    std::size_t shown = precision >= 0 and size > std::size_t(precision) ? precision : size;
+    if(integer)
+        shown = larger(shown, larger(precision > 0 ? precision : 0, 20) + 1);
+    return larger(width, shown);
+}
+
+inline char* write_text( const char *v, std::size_t size, char *out,
+        bool left, bool zero, std::size_t width, int precision )
+{
+    std::size_t n = precision >= 0 and size > std::size_t(precision) ? precision : size;
+    std::size_t fill = width > n ? width - n : 0;
+
+    if(!left)
+        out = pad(out, zero ? '0' : ' ', fill);
+    out = copy(out, v, n);
+    if(left)
+        out = pad(out, ' ', fill);
+    return out;
+}
+
+//positive is the sign of positive numbers, '+', ' ' or 0 for none
+inline char* write_integer( bool negative, boost::uint64_t value, char *out, unsigned base, bool upper,
+        bool left, bool zero, char positive, std::size_t width, int precision )
+{
+    static const char lower_digits[] = "0123456789abcdef", upper_digits[] = "0123456789ABCDEF";
+    const char *digit_chars = upper ? upper_digits : lower_digits;
+
+    char digits[24];
+    char *end = digits + sizeof(digits), *begin = end;
+    if(!(value == 0 and precision == 0))
+    {
+        do
+        {
+            *--begin = digit_chars[value % base];
+            value /= base;
+        } while(value);
+    }
+
+    std::size_t count = end - begin;
+    std::size_t zeros = precision > 0 and std::size_t(precision) > count ? precision - count : 0;
+    char sign = negative ? '-' : positive;
+    std::size_t total = count + zeros + (sign ? 1 : 0);
+    std::size_t fill = width > total ? width - total : 0;
+    bool zero_fill = zero and precision < 0;
+
+    if(!left and !zero_fill)
+        out = pad(out, ' ', fill);
+    if(sign)
+        *out++ = sign;
+    if(!left and zero_fill)
+        out = pad(out, '0', fill);
+    out = pad(out, '0', zeros);
+    out = copy(out, begin, count);
+    if(left)
+        out = pad(out, ' ', fill);
+    return out;
+}
+
+inline char* write_value( const char *v, std::size_t size, char *out, bool integer, unsigned base, bool upper,
+        bool left, bool zero, char positive, std::size_t width, int precision )
+{
+    bool negative;
+    boost::uint64_t number;
+    if(integer and parse_integer(v, size, negative, number))
+        return write_integer(negative, number, out, base, upper, left, zero, positive, width, precision);
+    return write_text(v, size, out, left, zero, width, precision);
+}
+
+//the exact size write_value produces, without writing anything
+inline std::size_t value_size( const char *v, std::size_t size, bool integer, unsigned base,
+        char positive, std::size_t width, int precision )
+{
+    bool negative;
+    boost::uint64_t number;
+    std::size_t shown;
+    if(integer and parse_integer(v, size, negative, number))
+    {
+        std::size_t count = number == 0 and precision == 0 ? 0 : 1;
+        for(; number >= base; number /= base)
+            ++count;
+        std::size_t zeros = precision > 0 and std::size_t(precision) > count ? precision - count : 0;
+        shown = count + zeros + (negative or positive ? 1 : 0);
+    }
+    else
+        shown = precision >= 0 and size > std::size_t(precision) ? precision : size;
+    return larger(width, shown);
+}
+
+} //namespace detail
+
+}
+
+#endif
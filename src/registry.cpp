@@ -0,0 +1,204 @@
+
+#include "registry.hpp"
+#include "pugixml.hpp"
+
+#include <boost/cstdint.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace composer
+{
+
+//the perfect hash is built by hash and displace: the names are spread over
+//buckets by a first hash. starting with the largest bucket, every bucket
+//searches a displacement that moves all of its names to free slots of the
+//table. a lookup hashes the name once, reads the displacement of its bucket
+//and compares the name stored at the slot.
+//--------------------------------------------------------------------------------
+
+namespace
+{
+    const boost::uint64_t fnv_basis = 0xcbf29ce484222325ull;
+    const boost::uint64_t fnv_prime = 0x100000001b3ull;
+
+    inline boost::uint64_t name_hash( const char *name, std::size_t size )
+    {
+        boost::uint64_t h = fnv_basis;
+        for( std::size_t i = 0; i < size; ++i )
+            h = (h ^ static_cast<unsigned char>(name[i])) * fnv_prime;
+        return h;
+    }
+
+    //moves a name hash with a displacement, the finalizer of murmur3
+    inline boost::uint64_t displace( boost::uint64_t h, boost::uint32_t d )
+    {
+        h ^= d * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    const boost::uint32_t max_displacement = 1 << 20;
+}
+
+class registry::impl
+{
+    public:
+        std::vector<message> messages_; //index is the id
+        std::vector<boost::uint32_t> displacements_; //per bucket
+        std::vector<boost::uint32_t> slots_; //table slot to id
+
+        bool build( const std::vector<boost::uint64_t> &hashes, std::size_t buckets )
+        {
+            std::vector<std::vector<std::size_t> > members(buckets);
+            for( std::size_t id = 0; id < hashes.size(); ++id )
+                members[hashes[id] % buckets].push_back(id);
+
+            std::vector<std::size_t> order(buckets);
+            for( std::size_t b = 0; b < buckets; ++b )
+                order[b] = b;
+            std::stable_sort(order.begin(), order.end(), [&]( std::size_t l, std::size_t r ) {
+                return members[l].size() > members[r].size();
+            });
+
+            const auto n = hashes.size();
+            displacements_.assign(buckets, 0);
+            slots_.assign(n, boost::uint32_t(npos));
+            std::vector<std::size_t> taken;
+            for( auto b: order )
+            {
+                if(members[b].empty())
+                    break;
+
+                boost::uint32_t d = 0;
+                for(; d < max_displacement; ++d )
+                {
+                    taken.clear();
+                    for( auto id: members[b] )
+                    {
+                        auto slot = displace(hashes[id], d) % n;
+                        if(slots_[slot] != boost::uint32_t(npos) 
+                                or std::find(taken.begin(), taken.end(), slot) != taken.end())
+                            break;
+                        taken.push_back(slot);
+                    }
+                    if(taken.size() == members[b].size())
+                        break;
+                }
+                if(d == max_displacement)
+                    return false;
+
+                displacements_[b] = d;
+                for( std::size_t i = 0; i < taken.size(); ++i )
+                    slots_[taken[i]] = boost::uint32_t(members[b][i]);
+            }
+            return true;
+        }
+
+        void build()
+        {
+            std::vector<boost::uint64_t> hashes;
+            for( const auto &m: messages_ )
+                hashes.push_back(name_hash(m.name().data(), m.name().size()));
+
+            if(hashes.empty())
+                return;
+            //about four names per bucket, more buckets if no displacement is found
+            for( std::size_t buckets = (hashes.size() + 3) / 4; buckets <= 4 * hashes.size(); buckets *= 2 )
+            {
+                if(build(hashes, buckets))
+                    return;
+            }
+            throw std::string("registry: no perfect hash found for the message names");
+        }
+};
+
+const registry::id_type registry::npos;
+
+registry::registry( const std::vector<message> &messages ):
+    pimpl_(new impl())
+{
+    pimpl_->messages_ = messages;
+    for( std::size_t i = 0; i < messages.size(); ++i )
+    {
+        for( std::size_t k = 0; k < i; ++k )
+            if(messages[k].name() == messages[i].name())
+                throw std::string("registry: duplicate message name ") + messages[i].name();
+    }
+    pimpl_->build();
+}
+
+registry registry::load( const boost::filesystem::path &location )
+{
+    pugi::xml_document doc;
+    auto rs = doc.load_file(location.string().c_str());
+    if(!rs)
+        throw std::string("registry: cannot load protocol ") + location.string() + ": " + rs.description();
+
+    auto protocol = doc.child("protocol");
+    if(!protocol)
+        throw std::string("registry: missing node protocol in ") + location.string();
+
+    std::vector<message> messages;
+    for( auto node = protocol.child("message"); node; node = node.next_sibling("message") )
+    {
+        std::string name = node.attribute("name").value();
+        auto format = node.attribute("format");
+        if(name.empty() or !format)
+            throw std::string("registry: message without name or format in ") + location.string();
+        messages.push_back(message(name, format.value()));
+    }
+    return registry(messages);
+}
+
+registry::id_type registry::id( const char *name, std::size_t size ) const
+{
+    const auto &imp = *pimpl_;
+    if(imp.slots_.empty())
+        return npos;
+
+    auto h = name_hash(name, size);
+    auto d = imp.displacements_[h % imp.displacements_.size()];
+    auto id = imp.slots_[displace(h, d) % imp.slots_.size()];
+
+    const auto &found = imp.messages_[id].name();
+    if(found.size() != size or std::memcmp(found.data(), name, size))
+        return npos;
+    return id;
+}
+
+registry::id_type registry::id( const std::string &name ) const
+{
+    return id(name.data(), name.size());
+}
+
+const message& registry::operator[]( id_type id ) const
+{
+    return pimpl_->messages_[id];
+}
+
+const message& registry::at( id_type id ) const
+{
+    if(id >= pimpl_->messages_.size())
+        throw std::string("registry: no message with this id");
+    return pimpl_->messages_[id];
+}
+
+const message& registry::get( const std::string &name ) const
+{
+    auto i = id(name);
+    if(i == npos)
+        throw std::string("registry: no such message ") + name;
+    return pimpl_->messages_[i];
+}
+
+std::size_t registry::size() const
+{
+    return pimpl_->messages_.size();
+}
+
+} //namespace composer
@@ -0,0 +1,63 @@
+/*registry.hpp
+ *
+ * The registry holds the compiled messages of a protocol. Every message gets
+ * a dense id, its position in the protocol definition, so hot paths keep ids
+ * and index the registry directly. Names are resolved to ids through a
+ * minimal perfect hash that is built when the registry is created: one
+ * hash, one table read and one compare per lookup.
+ *
+ * A protocol definition is an xml file:
+ *
+ *   <protocol>
+ *       <message name="status" format="#2;ST$(state:%s)#3;$checksum(%02X,xor)"/>
+ *       ...
+ *   </protocol>
+ * */
+
+#ifndef __REGISTRY_INCLUDE_GUARD_20_07__
+#define __REGISTRY_INCLUDE_GUARD_20_07__
+
+//std
+#include <string>
+#include <vector>
+#include <cstddef>
+
+//boost
+#include <boost/shared_ptr.hpp>
+#include <boost/filesystem.hpp>
+
+#include "composer.hpp"
+
+namespace composer
+{
+
+class registry
+{
+    class impl;
+    boost::shared_ptr<impl> pimpl_;
+
+    public:
+        typedef std::size_t id_type;
+        static const id_type npos = ~std::size_t(0);
+
+        //throws a std::string if two messages have the same name
+        explicit registry( const std::vector<message> &messages );
+
+        //compiles all messages of a protocol definition. throws a std::string
+        //on a missing file, invalid xml, a message without name or format or
+        //a format that does not compile.
+        static registry load( const boost::filesystem::path &location );
+
+        //npos for an unknown name
+        id_type id( const std::string &name ) const;
+        id_type id( const char *name, std::size_t size ) const;
+
+        const message& operator[]( id_type id ) const; //unchecked
+        const message& at( id_type id ) const; //throws a std::string
+        const message& get( const std::string &name ) const; //throws a std::string
+        std::size_t size() const;
+};
+
+} //namespace composer
+
+#endif
@@ -5,6 +5,12 @@
 #include <boost/make_shared.hpp>
 #include <boost/range/adaptors.hpp>
 #include <boost/range/algorithm.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/align/aligned_allocator.hpp>
+
+#include <algorithm>
+#include <cstring>
 
 namespace parsers
 {
@@ -24,101 +30,348 @@ namespace
     }
 }
 
-struct rule_impl
-{
-    std::string identity_;
+//compiled rules
+//--------------------------------------------------------------------------------
+//every rule is compiled into one fixed size record. a record fills exactly
+//one cache line and carries everything the rule needs except its delimiter
+//bytes, which live in a string pool next to the table. the records of a
+//message_parser are stored contiguous, so parsing a frame walks one array and
+//dispatches with a switch instead of following pointers to virtual objects.
 
-    rule_impl( const std::string &identity ):
-        identity_(identity)
+struct alignas(64) rule_record
+{
+    boost::uint8_t kind;
+    boost::uint32_t name; //index into rule_table::names_
+    boost::uint32_t offset, length; //offset rules and guards, min and max of length rules
+    boost::uint32_t start, start_size, end, end_size; //delimiters in the pool
+    union
     {
-    }
-    
-    virtual bool parse( const std::string &input, result_handler *rs ) = 0;
-    virtual ~rule_impl(){};
+        struct { boost::uint64_t word[2], mask[2]; } guard; //literal and its mask
+        struct { boost::uint32_t start, size; } separator; //group separator in the pool
+    };
 };
 
-struct offset_rule : public rule_impl
+namespace
 {
-    std::size_t pos_, length_;
-    offset_rule( const std::string &id, std::size_t pos, std::size_t len ):
-        rule_impl(id),
-        pos_(pos),
-        length_(len)
+    inline boost::uint32_t narrow( std::size_t value )
     {
+        if(value > 0xFFFFFFFFu)
+            throw std::string("rule argument out of range");
+        return static_cast<boost::uint32_t>(value);
+    }
+
+    const boost::uint32_t unbounded = 0xFFFFFFFFu;
 
+    inline boost::uint32_t saturate( std::size_t value )
+    {
+        return value > unbounded ? unbounded : static_cast<boost::uint32_t>(value);
     }
 
-    virtual bool parse( const std::string &input, result_handler *rs )
+    const std::size_t npos = std::size_t(-1);
+
+    //position of the first occurrence of pattern in data at or after from,
+    //like std::string::find but on a raw range
+    inline std::size_t find_bytes( const char *data, std::size_t size, std::size_t from,
+            const char *pattern, std::size_t length )
     {
-        bool too_short = (input.size() < pos_) 
-            or (input.size() < (pos_ + length_));
-        
-        if(too_short)
-            return false;
+        if(length == 0)
+            return from <= size ? from : npos;
 
-        auto rpos = input.begin() + pos_;
-        auto epos = input.begin() + (pos_ + length_);
-        return rs->field_parsed(identity_, std::string(rpos, epos));
-        //return true; 
+        while(from + length <= size)
+        {
+            auto hit = static_cast<const char*>(std::memchr(data + from, pattern[0], size - length + 1 - from));
+            if(!hit)
+                return npos;
+
+            std::size_t pos = hit - data;
+            if(std::memcmp(hit + 1, pattern + 1, length - 1) == 0)
+                return pos;
+            from = pos + 1;
+        }
+        return npos;
     }
-};
 
-struct finder_rule : public rule_impl
+    //walks the elements of a group with a cursor. the elements are reported
+    //through one scratch string, so no element allocates.
+    inline bool run_group( const rule_record &r, const char *pool, const std::string &name,
+            const char *data, std::size_t size, std::size_t begin, std::size_t end, 
+            std::string &value, result_handler *rs )
+    {
+        const char *sep = pool + r.separator.start;
+        std::size_t sep_size = r.separator.size;
+        std::size_t index = 0, cursor = begin;
+
+        while(cursor < end)
+        {
+            auto next = find_bytes(data, size, cursor, sep, sep_size);
+            if(next == npos or next + sep_size > end)
+                next = end;
+
+            value.assign(data + cursor, next - cursor);
+            if(!rs->element_parsed(name, index++, value))
+                return false;
+
+            cursor = next + sep_size;
+        }
+        return true;
+    }
+
+    //pool is the base of the string pool the record's delimiters refer to.
+    //value is a scratch string reused for every reported field.
+    inline bool run_rule( const rule_record &r, const char *pool, const std::string &name,
+            const char *data, std::size_t size, std::string &value, result_handler *rs )
+    {
+        switch(r.kind)
+        {
+            case parser_rule::guard_rule:
+            {
+                if(size < std::size_t(r.offset) + r.length)
+                    return false;
+
+                std::size_t window = r.length <= 8 ? 8 : 16;
+                boost::uint64_t in[2] = {0, 0};
+                if(size - r.offset >= window)
+                    std::memcpy(in, data + r.offset, window);
+                else //frame ends inside the window, do not read past it
+                    std::memcpy(in, data + r.offset, r.length);
+
+                return ((in[0] & r.guard.mask[0]) == r.guard.word[0]) 
+                    and ((in[1] & r.guard.mask[1]) == r.guard.word[1]);
+            }
+            case parser_rule::length_rule:
+                return size >= r.offset 
+                    and (r.length == unbounded or size <= r.length);
+            case parser_rule::offset_rule:
+            {
+                if(size < std::size_t(r.offset) + r.length)
+                    return false;
+
+                value.assign(data + r.offset, r.length);
+                return rs->field_parsed(name, value);
+            }
+            case parser_rule::finder_rule:
+            case parser_rule::group_rule:
+            {
+                auto apos = find_bytes(data, size, 0, pool + r.start, r.start_size);
+                if(apos == npos)
+                    return false;
+
+                auto start_read = apos + r.start_size;
+                auto end_pos = find_bytes(data, size, start_read, pool + r.end, r.end_size);
+                if(end_pos == npos)
+                    return false;
+
+                if(r.kind == parser_rule::group_rule)
+                    return run_group(r, pool, name, data, size, start_read, end_pos, value, rs);
+
+                value.assign(data + start_read, end_pos - start_read);
+                return rs->field_parsed(name, value);
+            }
+            default:
+                return false;
+        }
+    }
+}
+
+//the table of a message_parser: records, the string pool with all delimiter
+//bytes and the rule names handed to the result_handler.
+
+struct rule_table
 {
+    typedef std::vector<rule_record, boost::alignment::aligned_allocator<rule_record, 64> > records_type;
+
+    records_type records_;
+    std::string pool_;
+    std::vector<std::string> names_;
 
-    std::string start_, end_;
-    finder_rule( const std::string &id, const std::string &start, const std::string &end ):
-        rule_impl(id),
-        start_(start),
-        end_(end)
+    //compile one rule. delimiters are expected at pool offset "base"
+    static rule_record compile( const parser_rule &rule, std::size_t base, std::size_t name )
     {
-    };
+        rule_record r;
+        std::memset(&r, 0, sizeof(r));
+        r.kind = static_cast<boost::uint8_t>(rule.kind_);
+        r.name = narrow(name);
+        r.offset = narrow(rule.offset_);
+        r.length = rule.kind_ == parser_rule::length_rule ? saturate(rule.length_) : narrow(rule.length_);
+        r.start = narrow(base);
+        r.start_size = narrow(rule.start_size_);
+        r.end = narrow(base + rule.start_size_);
+        r.end_size = narrow(rule.end_size_);
+
+        if(rule.kind_ == parser_rule::guard_rule)
+        {
+            unsigned char pattern[16] = {0}, mask[16] = {0};
+            std::memcpy(pattern, rule.delimiters_.data(), rule.length_);
+            std::memset(mask, 0xFF, rule.length_);
+            std::memcpy(r.guard.word, pattern, sizeof(r.guard.word));
+            std::memcpy(r.guard.mask, mask, sizeof(r.guard.mask));
+        }
+        else if(rule.kind_ == parser_rule::group_rule)
+        {
+            r.separator.start = narrow(base + rule.start_size_ + rule.end_size_);
+            r.separator.size = narrow(rule.delimiters_.size() - rule.start_size_ - rule.end_size_);
+        }
+        return r;
+    }
+
+    void add( const parser_rule &rule )
+    {
+        records_.push_back(compile(rule, pool_.size(), names_.size()));
+        pool_ += rule.delimiters_;
+        names_.push_back(rule.identity_);
+    }
+
+    bool parse( const char *data, std::size_t size, result_handler *rs ) const
+    {
+        std::string value;
+        const char *pool = pool_.data();
+        for( const auto &r: records_ )
+        {
+            if(!run_rule(r, pool, names_[r.name], data, size, value, rs))
+                return false;
+        }
+        return true;
+    }
 
-    virtual bool parse( const std::string &input, result_handler *rs )
+    //a single rule is run on a record built on the stack, its delimiters
+    //are read from the rule itself.
+    static bool parse( const parser_rule &rule, const char *data, std::size_t size, result_handler *rs )
     {
-        auto apos = input.find(start_);
-        if(apos == std::string::npos)
-           return false; //false_value(identity_); 
-
-        auto start_read = apos + start_.size();
-        auto start_read_itr = input.begin() + start_read;
-        auto end_pos = input.find(end_, start_read);
-        if(end_pos == std::string::npos)
-            return false; //false_value(identity_);
-        
-        
-        return rs->field_parsed(identity_, std::string(start_read_itr, input.begin() + end_pos));
-        //return true;
+        std::string value;
+        auto r = compile(rule, 0, 0);
+        return run_rule(r, rule.delimiters_.data(), rule.identity_, data, size, value, rs);
     }
 };
 
 //--------------------------------------------------------------------------------
 
-parser_rule::parser_rule()
+parser_rule::parser_rule():
+    kind_(invalid_rule),
+    offset_(0),
+    length_(0),
+    start_size_(0),
+    end_size_(0)
 {
 }
 
 
 parser_rule::parser_rule( const std::string &ident, std::size_t offset, std::size_t length ):
-    pimpl_( new offset_rule(ident, offset, length ))
+    kind_(offset_rule),
+    identity_(ident),
+    offset_(offset),
+    length_(length),
+    start_size_(0),
+    end_size_(0)
 {
 
 }
 
 parser_rule::parser_rule( const std::string &ident, const std::string &startdel, const std::string &enddel):
-    pimpl_(new finder_rule(ident, startdel, enddel))
+    kind_(finder_rule),
+    identity_(ident),
+    offset_(0),
+    length_(0),
+    delimiters_(startdel + enddel),
+    start_size_(startdel.size()),
+    end_size_(enddel.size())
+{
+
+}
+
+parser_rule::parser_rule( const std::string &ident, const std::string &startdel, 
+        const std::string &enddel, const std::string &separator ):
+    kind_(group_rule),
+    identity_(ident),
+    offset_(0),
+    length_(0),
+    delimiters_(startdel + enddel + separator),
+    start_size_(startdel.size()),
+    end_size_(enddel.size())
+{
+    if(separator.empty())
+        throw std::string("group separator must not be empty: ") + ident;
+}
+
+parser_rule::parser_rule( const std::string &ident, std::size_t offset, const std::string &literal ):
+    kind_(guard_rule),
+    identity_(ident),
+    offset_(offset),
+    length_(literal.size()),
+    delimiters_(literal),
+    start_size_(literal.size()),
+    end_size_(0)
 {
+    if(literal.empty() or literal.size() > 16)
+        throw std::string("guard literal must have 1 to 16 bytes: ") + literal;
+}
 
+parser_rule::parser_rule( const std::string &ident, const frame_length &range ):
+    kind_(length_rule),
+    identity_(ident),
+    offset_(range.min),
+    length_(range.max),
+    start_size_(0),
+    end_size_(0)
+{
+    if(range.min > range.max)
+        throw std::string("empty frame length range: ") + ident;
 }
 
 bool parser_rule::parse( const std::string &input, result_handler *rs ) const
 {
-    return pimpl_->parse(input, rs);
+    return parse(input.data(), input.size(), rs);
+}
+
+bool parser_rule::parse( const char *data, std::size_t size, result_handler *rs ) const
+{
+    return rule_table::parse(*this, data, size, rs);
 }
 
 std::string parser_rule::name() const
 {
-    return pimpl_->identity_;
+    return identity_;
+}
+
+parser_rule::kind_type parser_rule::kind() const
+{
+    return kind_;
+}
+
+bool parser_rule::is_guard() const
+{
+    return kind_ == guard_rule;
+}
+
+std::size_t parser_rule::offset() const
+{
+    return offset_;
+}
+
+std::size_t parser_rule::length() const
+{
+    return length_;
+}
+
+std::string parser_rule::literal() const
+{
+    return kind_ == guard_rule ? delimiters_ : std::string();
+}
+
+std::size_t parser_rule::min_frame() const
+{
+    switch(kind_)
+    {
+        case offset_rule:
+        case guard_rule:
+            return offset_ + length_;
+        case finder_rule:
+        case group_rule:
+            return start_size_ + end_size_;
+        case length_rule:
+            return offset_;
+        default:
+            return 0;
+    }
 }
 
 
@@ -128,38 +381,94 @@ std::string parser_rule::name() const
 struct message_parser::impl
 {
     std::string name_;
-    boost::unordered_map<std::string, parser_rule> parsers_;
+    rule_table rules_; //length rules and guards first
+
+    //what the rules tell about accepted frames, used to prove exclusivity
+    std::size_t min_frame_, max_frame_;
+    std::vector<std::pair<std::size_t, std::string> > guards_;
 };
 
 message_parser::message_parser( message_parser_factory &fc ):
     pimpl_(new impl())
 {
     pimpl_->name_ = fc.identity();
+    pimpl_->min_frame_ = 0;
+    pimpl_->max_frame_ = std::size_t(-1);
+
+    //every rule name is taken once, the first rule wins
+    boost::unordered_set<std::string> names;
+    std::vector<const parser_rule*> checks, others;
     for( const auto &item: fc.items()) {
-        pimpl_->parsers_.insert(std::make_pair(item.name(), item));
+        if(!names.insert(item.name()).second)
+            continue;
+
+        pimpl_->min_frame_ = std::max(pimpl_->min_frame_, item.min_frame());
+        if(item.kind() == parser_rule::length_rule)
+            pimpl_->max_frame_ = std::min(pimpl_->max_frame_, item.length());
+        if(item.is_guard())
+            pimpl_->guards_.push_back(std::make_pair(item.offset(), item.literal()));
+
+        if(item.is_guard() or item.kind() == parser_rule::length_rule)
+            checks.push_back(&item);
+        else
+            others.push_back(&item);
     }
+
+    //length rules are the cheapest reject, they go in front of the guards
+    std::stable_sort(checks.begin(), checks.end(), 
+            []( const parser_rule *a, const parser_rule *b ) {
+                return a->kind() == parser_rule::length_rule 
+                    and b->kind() != parser_rule::length_rule;
+            });
+
+    for( auto rule: checks )
+        pimpl_->rules_.add(*rule);
+    for( auto rule: others )
+        pimpl_->rules_.add(*rule);
 }
 
 bool message_parser::parse( const std::string &input, result_handler *rs ) const
 {
+    return parse(input.data(), input.size(), rs);
+}
+
+bool message_parser::parse( const char *data, std::size_t size, result_handler *rs ) const
+{
+    if(!pimpl_->rules_.parse(data, size, rs))
+        return false;
+
+    rs->set_name(pimpl_->name_);
+    rs->parsed_successful(true);
+    return true;
+}
+
+std::string message_parser::name() const
+{
+    return pimpl_->name_;
+}
+
+bool message_parser::exclusive_of( const message_parser &other ) const
+{
+    const impl &a = *pimpl_, &b = *other.pimpl_;
 
-    bool found = true;
+    if(a.max_frame_ < b.min_frame_ or b.max_frame_ < a.min_frame_)
+        return true;
 
-    for(const auto &item: pimpl_->parsers_ )
+    for( const auto &ga: a.guards_ )
     {
-        if(!item.second.parse(input, rs))
+        for( const auto &gb: b.guards_ )
         {
-            found = false;
-            break;
+            auto from = std::max(ga.first, gb.first);
+            auto to = std::min(ga.first + ga.second.size(), gb.first + gb.second.size());
+            for( auto pos = from; pos < to; ++pos )
+            {
+                if(ga.second[pos - ga.first] != gb.second[pos - gb.first])
+                    return true;
+            }
         }
     }
 
-    if(!found)
-        return false;
-
-    rs->set_name(pimpl_->name_);
-    rs->parsed_successful(true);
-    return true;
+    return false;
 }
 
 //--------------------------------------------------------------------------------
@@ -169,21 +478,48 @@ struct scanner::impl
 {
     std::string name_;
     std::vector<message_parser> values_;
+    ambiguity_list ambiguities_;
 };
 
 
-scanner::scanner( scanner_factory &f ):
+scanner::scanner( scanner_factory &f, bool strict ):
     pimpl_(new impl())
 {
     pimpl_->name_ = f.identity();
     pimpl_->values_ = f.items();
+
+    const auto &values = pimpl_->values_;
+    for( std::size_t i = 0; i < values.size(); ++i )
+    {
+        for( std::size_t j = i + 1; j < values.size(); ++j )
+        {
+            if(values[i].exclusive_of(values[j]))
+                continue;
+
+            if(strict)
+                throw std::string("ambiguous parsers in scanner ") + pimpl_->name_ 
+                    + ": " + values[i].name() + ", " + values[j].name();
+
+            pimpl_->ambiguities_.push_back(std::make_pair(values[i].name(), values[j].name()));
+        }
+    }
+}
+
+const scanner::ambiguity_list& scanner::ambiguities() const
+{
+    return pimpl_->ambiguities_;
 }
 
 bool scanner::parse( const std::string &input, result_handler *rs ) const
+{
+    return parse(input.data(), input.size(), rs);
+}
+
+bool scanner::parse( const char *data, std::size_t size, result_handler *rs ) const
 {
     for( const auto &item: pimpl_->values_)
     {
-        if(item.parse(input, rs))
+        if(item.parse(data, size, rs))
             return true;
     }
     rs->parsed_successful(false);
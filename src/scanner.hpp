@@ -2,6 +2,8 @@
  *
  * This file contain the Scanner class.
  * It gets input by the method "parse" that will take a string as argument.
+ * Every parse method has an overload for a raw (data, size) range, so frames
+ * can be parsed in place in receive buffers, mapped files or shared memory.
  * Calling the parse method can trigger one or more events, in case the string
  * could parsed successfully, or exactly one error event, in case the string
  * could not be parsed at all.
@@ -13,6 +15,7 @@
 //std
 #include <vector>
 #include <string>
+#include <utility>
 
 //boost
 #include <boost/shared_ptr.hpp>
@@ -30,13 +33,43 @@ class result_handler
         virtual void parsed_successful( bool success ) = 0;
         virtual void set_name( const std::string &name ) = 0;
         virtual bool field_parsed( const std::string &name, const std::string &value ) = 0;
+
+        //called once for every element of a repeating group, index counts from 0.
+        //the value is only valid during the call. by default every element is
+        //handed over to field_parsed.
+        virtual bool element_parsed( const std::string &name, std::size_t /*index*/, const std::string &value )
+        {
+            return field_parsed(name, value);
+        }
+
         virtual ~result_handler(){};
 };
 
-class rule_impl;
+struct rule_table;
+
+//inclusive bounds for the size of a complete frame, used by length rules
+struct frame_length
+{
+    std::size_t min, max;
+};
+
+//a parser_rule is a plain description of one rule. it owns no heap object
+//besides its strings, so copying it never touches a reference count. the
+//rules of a message_parser are compiled into one contiguous table.
 class parser_rule
 {
-    boost::shared_ptr<rule_impl> pimpl_;
+    public:
+        enum kind_type { invalid_rule, offset_rule, finder_rule, guard_rule, group_rule, length_rule };
+
+    private:
+        friend struct rule_table;
+
+        kind_type kind_;
+        std::string identity_;
+        std::size_t offset_, length_;
+        std::string delimiters_; //start, end and group separator, or the guard literal
+        std::size_t start_size_, end_size_; //sizes of the delimiters within delimiters_
+
     public:
 
         //this constructor will create a new offset rule. it will try to cut the string
@@ -48,10 +81,34 @@ class parser_rule
         parser_rule( const std::string &ident, 
                 const std::string &startdel, const std::string &enddel );
 
+        //this creates a guard rule. it asserts that the bytes of "literal" appear
+        //at exactly the given offset and reports no field. the literal is compiled
+        //into one masked 8 or 16 byte compare, so it may not exceed 16 bytes.
+        //guards are always evaluated first in a message_parser.
+        parser_rule( const std::string &ident, std::size_t offset, const std::string &literal );
+
+        //this creates a repeating group. the group is found like a finding rule,
+        //between "startdel" and "enddel", and is cut into elements at every
+        //"separator". each element is reported with its index by element_parsed.
+        //a separator directly before enddel does not open an empty element.
+        parser_rule( const std::string &ident, const std::string &startdel, 
+                const std::string &enddel, const std::string &separator );
+
+        //this creates a length rule. it accepts only frames whose size lies within
+        //"range" and reports no field. like guards it runs before the other rules.
+        parser_rule( const std::string &ident, const frame_length &range );
+
         parser_rule(); //invalid empty rule. Needed vor conformance with std::vector
 
         std::string name() const;
+        kind_type kind() const;
+        bool is_guard() const;
+        std::size_t offset() const;
+        std::size_t length() const;
+        std::string literal() const; //the bytes asserted by a guard
+        std::size_t min_frame() const; //smallest frame the rule can accept
         bool parse( const std::string &input, result_handler *rs ) const;
+        bool parse( const char *data, std::size_t size, result_handler *rs ) const;
 };
 
 
@@ -81,6 +138,8 @@ typedef generic_factory<parser_rule> message_parser_factory;
 //one for each field.
 //The parser will return true if, and only if all rules are succeeded, means
 //the label name, y and y pos were readable.
+//Length and guard rules run before all other rules, so a frame of another
+//message type is usually rejected by a size check or a single word compare.
 
 class message_parser
 {
@@ -91,7 +150,15 @@ class message_parser
         
         //return true only if all rules applied successfull
         bool parse( const std::string &input, result_handler *rs ) const; 
+        bool parse( const char *data, std::size_t size, result_handler *rs ) const; 
 
+        std::string name() const;
+
+        //true if no frame can be accepted by both parsers. this is proven from
+        //the rules alone: either the frame length ranges are disjoint, or two
+        //guards assert different bytes at the same position. false means the
+        //parsers could not be proven to be exclusive.
+        bool exclusive_of( const message_parser &other ) const;
 };
 
 //class scanner hosts at least one or more message parser.
@@ -101,6 +168,11 @@ class message_parser
 //invalid. 
 //If none of the parsers succeeded, that means a protocol breakthrough
 //or an illegal or unsupported message has been received.
+//
+//Running every parser to detect ambiguity would be too expensive, so the
+//scanner checks all pairs of parsers once when it is built. Pairs that can
+//not be proven exclusive are listed by ambiguities(), a strict scanner
+//refuses them. parse then stops at the first parser that succeeds.
 
 typedef generic_factory<message_parser> scanner_factory;
 
@@ -109,10 +181,17 @@ class scanner
     class impl;
     boost::shared_ptr<impl> pimpl_;
     public:
-        scanner( scanner_factory &f );
+        typedef std::vector<std::pair<std::string, std::string> > ambiguity_list;
+
+        //throws a std::string naming the first ambiguous pair if strict is set
+        scanner( scanner_factory &f, bool strict = false );
 
         //return true if exactly one parser was successfull
         bool parse( const std::string &input, result_handler *rs ) const;
+        bool parse( const char *data, std::size_t size, result_handler *rs ) const;
+
+        //pairs of parsers that could not be proven to be exclusive
+        const ambiguity_list& ambiguities() const;
 };
 
 } //namespace parsers
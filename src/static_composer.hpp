@@ -0,0 +1,494 @@
+/*static_composer.hpp
+ *
+ * Compile-time front end of the composer for message layouts that are fixed
+ * in the code. The format is a constexpr char array at namespace scope and
+ * is parsed by the compiler, with the same syntax as composer::message:
+ * literals, \ escapes, #nn; ascii codes, $(field:spec) and $repeat(c, n).
+ * Every piece of the format becomes an instantiation of its own writer, so
+ * format is one inlined routine of constant copies and field writers whose
+ * widths and flags are constants. The field writers are those of
+ * field_writer.hpp that composer::message uses as well. A malformed format
+ * is a compile error.
+ *
+ *   constexpr char heartbeat[] = "HB $(id:%04d)#13;";
+ *   typedef composer::static_message<heartbeat> heartbeat_message;
+ *
+ * The output is the output of composer::message for the same format. Only
+ * the printf conversions d, i, u, x, X and s are compiled. Specs that the
+ * runtime hands to boost::format, binary encodings and the functions that
+ * need a context ($now, $checksum, $seq) are refused with a static_assert.
+ * The constexpr parser recurses once per char of a literal run, very long
+ * formats may need a higher -fconstexpr-depth.
+ * */
+
+#ifndef __STATIC_COMPOSER_INCLUDE_GUARD_10_27__
+#define __STATIC_COMPOSER_INCLUDE_GUARD_10_27__
+
+//std
+#include <string>
+#include <cstring>
+
+//boost
+#include <boost/cstdint.hpp>
+
+#include "composer.hpp"
+#include "common.hpp"
+#include "field_writer.hpp"
+
+namespace composer
+{
+
+namespace detail
+{
+
+//the constexpr parser
+//--------------------------------------------------------------------------------
+//a position is an index into the format, npos marks an unterminated piece.
+//all scans stop at npos and the terminating zero, so a malformed format
+//only fails its static_assert.
+
+constexpr std::size_t npos = ~std::size_t(0);
+
+enum piece_kind { end_piece, literal_piece, escape_piece, ascii_piece, field_piece, function_piece };
+
+constexpr bool is_digit( char c )
+{
+    return c >= '0' and c <= '9';
+}
+
+constexpr int kind_at( const char *f, std::size_t pos )
+{
+    return pos == npos or f[pos] == 0 ? end_piece
+        : f[pos] == '\\' ? escape_piece
+        : f[pos] == '#' ? ascii_piece
+        : f[pos] != '$' ? literal_piece
+        : f[pos + 1] == '(' ? field_piece : function_piece;
+}
+
+//position of c at or after pos, or of the terminating zero
+constexpr std::size_t find( const char *f, std::size_t pos, char c )
+{
+    return f[pos] == c or f[pos] == 0 ? pos : find(f, pos + 1, c);
+}
+
+//position of c in [pos, end), or end
+constexpr std::size_t find_in( const char *f, std::size_t pos, std::size_t end, char c )
+{
+    return pos >= end or f[pos] == c ? pos : find_in(f, pos + 1, end, c);
+}
+
+constexpr std::size_t literal_end( const char *f, std::size_t pos )
+{
+    return f[pos] == 0 or f[pos] == '\\' or f[pos] == '#' or f[pos] == '$' ? pos : literal_end(f, pos + 1);
+}
+
+//the escaped char, line breaks after the backslash are skipped
+constexpr std::size_t escaped_char( const char *f, std::size_t pos )
+{
+    return f[pos] == '\n' or f[pos] == '\r' ? escaped_char(f, pos + 1) : (f[pos] ? pos : npos);
+}
+
+constexpr std::size_t closed( const char *f, std::size_t pos )
+{
+    return f[pos] ? pos + 1 : npos;
+}
+
+constexpr std::size_t piece_end( const char *f, std::size_t pos )
+{
+    return kind_at(f, pos) == end_piece ? pos
+        : kind_at(f, pos) == literal_piece ? literal_end(f, pos)
+        : kind_at(f, pos) == escape_piece ? (escaped_char(f, pos + 1) == npos ? npos : escaped_char(f, pos + 1) + 1)
+        : kind_at(f, pos) == ascii_piece ? closed(f, find(f, pos + 1, ';'))
+        : kind_at(f, pos) == field_piece ? closed(f, find(f, pos + 2, ')'))
+        : f[find(f, pos + 1, '(')] ? closed(f, find(f, find(f, pos + 1, '(') + 1, ')')) : npos;
+}
+
+constexpr bool well_formed( const char *f, std::size_t pos )
+{
+    return pos != npos and (kind_at(f, pos) == end_piece or well_formed(f, piece_end(f, pos)));
+}
+
+constexpr std::size_t skip_digits( const char *f, std::size_t pos, std::size_t end )
+{
+    return pos < end and is_digit(f[pos]) ? skip_digits(f, pos + 1, end) : pos;
+}
+
+constexpr std::size_t skip_spaces( const char *f, std::size_t pos, std::size_t end )
+{
+    return pos < end and f[pos] == ' ' ? skip_spaces(f, pos + 1, end) : pos;
+}
+
+constexpr boost::uint64_t read_number( const char *f, std::size_t pos, std::size_t end, boost::uint64_t n = 0 )
+{
+    return pos < end and is_digit(f[pos]) ? read_number(f, pos + 1, end, n * 10 + (f[pos] - '0')) : n;
+}
+
+constexpr bool equal( const char *f, std::size_t pos, std::size_t end, const char *s )
+{
+    return pos == end ? *s == 0 : (*s != 0 and f[pos] == *s and equal(f, pos + 1, end, s + 1));
+}
+
+constexpr bool same_text( const char *f, std::size_t a, std::size_t b, std::size_t size )
+{
+    return size == 0 or (f[a] == f[b] and same_text(f, a + 1, b + 1, size - 1));
+}
+
+//fields and their slots
+//--------------------------------------------------------------------------------
+//a field is $(name) or $(name:spec). as in message::keys the slot of a name
+//is the number of distinct names before its first appearance.
+
+constexpr std::size_t name_end( const char *f, std::size_t pos )
+{
+    return f[pos] == ':' or f[pos] == ')' or f[pos] == 0 ? pos : name_end(f, pos + 1);
+}
+
+constexpr bool same_name( const char *f, std::size_t a, std::size_t b )
+{
+    return name_end(f, a + 2) - a == name_end(f, b + 2) - b
+        and same_text(f, a + 2, b + 2, name_end(f, a + 2) - a - 2);
+}
+
+constexpr std::size_t next_field( const char *f, std::size_t pos )
+{
+    return kind_at(f, pos) == end_piece ? npos
+        : kind_at(f, pos) == field_piece ? pos : next_field(f, piece_end(f, pos));
+}
+
+//the first field from pos with the name of the field at target
+constexpr std::size_t first_field( const char *f, std::size_t pos, std::size_t target )
+{
+    return same_name(f, next_field(f, pos), target) ? next_field(f, pos)
+        : first_field(f, piece_end(f, next_field(f, pos)), target);
+}
+
+constexpr bool first_appearance( const char *f, std::size_t pos )
+{
+    return first_field(f, 0, pos) == pos;
+}
+
+//distinct names of the fields from field pos up to limit
+constexpr std::size_t count_names( const char *f, std::size_t pos, std::size_t limit )
+{
+    return pos == npos or pos >= limit ? 0
+        : (first_appearance(f, pos) ? 1 : 0) + count_names(f, next_field(f, piece_end(f, pos)), limit);
+}
+
+constexpr std::size_t slot_of( const char *f, std::size_t pos )
+{
+    return count_names(f, next_field(f, 0), first_field(f, 0, pos));
+}
+
+//the spec of the field at pos starts after the colon, it is empty without one
+constexpr std::size_t spec_begin( const char *f, std::size_t pos )
+{
+    return f[name_end(f, pos + 2)] == ':' ? name_end(f, pos + 2) + 1 : piece_end(f, pos) - 1;
+}
+
+//field specs
+//--------------------------------------------------------------------------------
+//the printf subset of field_format: literal text around one conversion with
+//the flags - 0 + and space, a width, a precision and d, i, u, x, X or s.
+//a spec without a conversion is literal text in front of the value.
+
+//the first single % in [pos, end), %% is a literal percent sign
+constexpr std::size_t conversion_at( const char *f, std::size_t pos, std::size_t end )
+{
+    return pos >= end ? end
+        : f[pos] != '%' ? conversion_at(f, pos + 1, end)
+        : pos + 1 < end and f[pos + 1] == '%' ? conversion_at(f, pos + 2, end) : pos;
+}
+
+//size of literal text with %% written as one char
+constexpr std::size_t text_size( const char *f, std::size_t pos, std::size_t end )
+{
+    return pos >= end ? 0 : 1 + text_size(f, f[pos] == '%' ? pos + 2 : pos + 1, end);
+}
+
+constexpr std::size_t skip_flags( const char *f, std::size_t pos, std::size_t end )
+{
+    return pos < end and (f[pos] == '-' or f[pos] == '0' or f[pos] == '+' or f[pos] == ' ')
+        ? skip_flags(f, pos + 1, end) : pos;
+}
+
+constexpr std::size_t skip_modifiers( const char *f, std::size_t pos, std::size_t end )
+{
+    return pos < end and (f[pos] == 'h' or f[pos] == 'l' or f[pos] == 'L' or f[pos] == 'q'
+            or f[pos] == 'j' or f[pos] == 'z' or f[pos] == 't') ? skip_modifiers(f, pos + 1, end) : pos;
+}
+
+constexpr bool valid_order( const char *f, std::size_t pos, std::size_t end, boost::uint64_t bits )
+{
+    return bits == 8 ? pos == end : (equal(f, pos, end, "be") or equal(f, pos, end, "le"));
+}
+
+//the binary encodings accepted by field_format::compile_binary
+constexpr bool binary_spec( const char *f, std::size_t pos, std::size_t end )
+{
+    return end - pos >= 3 and f[pos] == 'b' and f[pos + 1] == 'c' and f[pos + 2] == 'd'
+            ? skip_digits(f, pos + 3, end) == end and read_number(f, pos + 3, end) >= 1 and read_number(f, pos + 3, end) <= 32
+        : end - pos >= 2 and f[pos] == 'l' and f[pos + 1] == 'p'
+            ? (read_number(f, pos + 2, end) == 8 or read_number(f, pos + 2, end) == 16)
+                and valid_order(f, skip_digits(f, pos + 2, end), end, read_number(f, pos + 2, end))
+        : end - pos >= 1 and (f[pos] == 'u' or f[pos] == 'i')
+            ? (read_number(f, pos + 1, end) == 8 or read_number(f, pos + 1, end) == 16
+                    or read_number(f, pos + 1, end) == 32 or read_number(f, pos + 1, end) == 64)
+                and valid_order(f, skip_digits(f, pos + 1, end), end, read_number(f, pos + 1, end))
+        : false;
+}
+
+//literal text of a spec in [Begin, End), copied in runs between the %%
+template<const char *F, std::size_t Begin, std::size_t End, bool Empty = (Begin >= End)>
+struct spec_text
+{
+    static char* write( char *out )
+    {
+        constexpr std::size_t percent = find_in(F, Begin, End, '%');
+        out = copy(out, F + Begin, percent - Begin + (percent < End ? 1 : 0));
+        return spec_text<F, (percent < End ? percent + 2 : End), End>::write(out);
+    }
+};
+
+template<const char *F, std::size_t Begin, std::size_t End>
+struct spec_text<F, Begin, End, true>
+{
+    static char* write( char *out ) { return out; }
+};
+
+//the spec F[Begin, End) of one field, every property is a constant
+template<const char *F, std::size_t Begin, std::size_t End>
+struct field_spec
+{
+    static constexpr std::size_t percent = conversion_at(F, Begin, End);
+    static constexpr bool plain = percent == End;
+    static constexpr std::size_t flags_end = plain ? End : skip_flags(F, percent + 1, End);
+    static constexpr bool left = !plain and find_in(F, percent + 1, flags_end, '-') < flags_end;
+    static constexpr bool zero = !plain and find_in(F, percent + 1, flags_end, '0') < flags_end;
+    static constexpr char positive = plain ? 0 : find_in(F, percent + 1, flags_end, '+') < flags_end ? '+'
+        : find_in(F, percent + 1, flags_end, ' ') < flags_end ? ' ' : 0;
+    static constexpr std::size_t width_end = skip_digits(F, flags_end, End);
+    static constexpr std::size_t width = read_number(F, flags_end, width_end);
+    static constexpr bool has_precision = width_end < End and F[width_end] == '.';
+    static constexpr std::size_t precision_end = has_precision ? skip_digits(F, width_end + 1, End) : width_end;
+    static constexpr int precision = has_precision ? int(read_number(F, width_end + 1, precision_end)) : -1;
+    static constexpr std::size_t conversion = skip_modifiers(F, precision_end, End);
+    static constexpr char conv = plain ? 's' : (conversion < End ? F[conversion] : 0);
+    static constexpr bool integer = conv != 's';
+    static constexpr unsigned base = conv == 'x' or conv == 'X' ? 16 : 10;
+    static constexpr std::size_t prefix_end = plain ? End : percent;
+    static constexpr std::size_t suffix_begin = plain ? End : conversion + 1;
+    static constexpr std::size_t text = text_size(F, Begin, prefix_end) + text_size(F, suffix_begin, End);
+
+    //the exact size write produces for the value
+    static std::size_t written_size( const char *v, std::size_t size )
+    {
+        return text + value_size(v, size, integer, base, positive, width, precision);
+    }
+
+    static char* write( const char *v, std::size_t size, char *out )
+    {
+        static_assert(!binary_spec(F, Begin, End), "binary field encodings need composer::message");
+        static_assert(plain or conv == 'd' or conv == 'i' or conv == 'u' or conv == 'x' or conv == 'X' or conv == 's', 
+                "only the conversions d, i, u, x, X and s are compiled, other field specs need composer::message");
+        static_assert(conversion_at(F, suffix_begin, End) == End, "more than one conversion in a field spec");
+
+        out = spec_text<F, Begin, prefix_end>::write(out);
+        out = write_value(v, size, out, integer, base, conv == 'X', left, zero, positive, width, precision);
+        return spec_text<F, suffix_begin, End>::write(out);
+    }
+};
+
+//pieces
+//--------------------------------------------------------------------------------
+//the writer of the piece at Pos, it writes its bytes and goes on with the
+//next piece. the recursion is resolved by the compiler, format is the
+//chain of all writers inlined into one function.
+
+template<const char *F, std::size_t Pos, int Kind = kind_at(F, Pos)>
+struct piece;
+
+template<const char *F, std::size_t Pos>
+struct piece<F, Pos, end_piece>
+{
+    static std::size_t bound( const value_ref* ) { return 0; }
+    static char* write( const value_ref*, char *out ) { return out; }
+};
+
+template<const char *F, std::size_t Pos>
+struct piece<F, Pos, literal_piece>
+{
+    typedef piece<F, literal_end(F, Pos)> next;
+    static constexpr std::size_t size = literal_end(F, Pos) - Pos;
+
+    static std::size_t bound( const value_ref *slots )
+    {
+        return size + next::bound(slots);
+    }
+
+    static char* write( const value_ref *slots, char *out )
+    {
+        return next::write(slots, copy(out, F + Pos, size));
+    }
+};
+
+template<const char *F, std::size_t Pos>
+struct piece<F, Pos, escape_piece>
+{
+    typedef piece<F, piece_end(F, Pos)> next;
+    static constexpr char value = F[escaped_char(F, Pos + 1)];
+
+    static std::size_t bound( const value_ref *slots )
+    {
+        return 1 + next::bound(slots);
+    }
+
+    static char* write( const value_ref *slots, char *out )
+    {
+        *out++ = value;
+        return next::write(slots, out);
+    }
+};
+
+template<const char *F, std::size_t Pos>
+struct piece<F, Pos, ascii_piece>
+{
+    typedef piece<F, piece_end(F, Pos)> next;
+    static constexpr std::size_t close = find(F, Pos + 1, ';');
+    static constexpr boost::uint64_t code = read_number(F, Pos + 1, close);
+
+    static_assert(close > Pos + 1 and close <= Pos + 4 and skip_digits(F, Pos + 1, close) == close and code < 256, 
+            "illegal ascii char code, #nn; needs a number below 256");
+
+    static std::size_t bound( const value_ref *slots )
+    {
+        return 1 + next::bound(slots);
+    }
+
+    static char* write( const value_ref *slots, char *out )
+    {
+        *out++ = char(code);
+        return next::write(slots, out);
+    }
+};
+
+template<const char *F, std::size_t Pos>
+struct piece<F, Pos, field_piece>
+{
+    typedef piece<F, piece_end(F, Pos)> next;
+    typedef field_spec<F, spec_begin(F, Pos), piece_end(F, Pos) - 1> format;
+    static constexpr std::size_t slot = slot_of(F, Pos);
+
+    static std::size_t bound( const value_ref *slots )
+    {
+        return format::written_size(slots[slot].data, slots[slot].size) + next::bound(slots);
+    }
+
+    static char* write( const value_ref *slots, char *out )
+    {
+        return next::write(slots, format::write(slots[slot].data, slots[slot].size, out));
+    }
+};
+
+//$repeat(c, n) is the only function without a context. as in the runtime
+//compiler c is an ascii code if it is a number and a char otherwise.
+template<const char *F, std::size_t Pos>
+struct piece<F, Pos, function_piece>
+{
+    typedef piece<F, piece_end(F, Pos)> next;
+    static constexpr std::size_t open = find(F, Pos + 1, '(');
+    static constexpr std::size_t close = piece_end(F, Pos) - 1;
+    static constexpr std::size_t comma = find_in(F, open + 1, close, ',');
+    static constexpr std::size_t count_end = find_in(F, comma + 1, close, ',');
+    static constexpr std::size_t code = skip_spaces(F, open + 1, comma);
+    static constexpr std::size_t number = skip_spaces(F, comma + 1, count_end);
+    static constexpr char fill = code < comma and is_digit(F[code]) ? char(read_number(F, code, comma)) : F[open + 1];
+    static constexpr std::size_t count = read_number(F, number, count_end);
+
+    static_assert(equal(F, Pos + 1, open, "repeat"), "no such function, $now, $checksum and $seq need composer::message");
+    static_assert(comma < close, "arity error: repeat function needs two argument");
+    static_assert(comma > open + 1, "argument error: function repeat needs a character at 1st position");
+    static_assert(number < count_end and is_digit(F[number]), 
+            "argument error: function repeat needs a numeric argument at 2nd position");
+
+    static std::size_t bound( const value_ref *slots )
+    {
+        return count + next::bound(slots);
+    }
+
+    static char* write( const value_ref *slots, char *out )
+    {
+        return next::write(slots, pad(out, fill, count));
+    }
+};
+
+} //namespace detail
+
+//static_message
+//--------------------------------------------------------------------------------
+//a message compiled from a constexpr format, Format must be a char array
+//with linkage, not a string literal. the members mirror those of message,
+//a too small count or capacity throws a std::string.
+template<const char *Format>
+class static_message
+{
+    static_assert(detail::well_formed(Format, 0), "unterminated field, function or ascii code in format");
+
+    //a malformed format only fails the assert above
+    typedef detail::piece<Format, detail::well_formed(Format, 0) ? 0 : detail::npos> first;
+
+    public:
+        //number of distinct fields, the size of keys()
+        static constexpr std::size_t field_count = detail::count_names(Format, detail::next_field(Format, 0), detail::npos);
+
+        static const common::string_list& keys()
+        {
+            static const common::string_list names = collect_keys();
+            return names;
+        }
+
+        static std::size_t size_bound( const value_ref *slots, std::size_t count )
+        {
+            check(count);
+            return first::bound(slots);
+        }
+
+        static std::size_t format( const value_ref *slots, std::size_t count, char *buffer, std::size_t capacity )
+        {
+            if(capacity < size_bound(slots, count))
+                throw std::string("buffer below the size bound of a static message");
+            return first::write(slots, buffer) - buffer;
+        }
+
+        static std::string format( const value_ref *slots, std::size_t count )
+        {
+            std::string out(size_bound(slots, count), '\0');
+            out.resize(first::write(slots, &out[0]) - &out[0]);
+            return out;
+        }
+
+    private:
+        static void check( std::size_t count )
+        {
+            if(count < field_count)
+                throw std::string("too few field values for static message");
+        }
+
+        static common::string_list collect_keys()
+        {
+            common::string_list names;
+            for( auto pos = detail::next_field(Format, 0); pos != detail::npos;
+                    pos = detail::next_field(Format, detail::piece_end(Format, pos)) )
+            {
+                if(detail::first_appearance(Format, pos))
+                    names.push_back(std::string(Format + pos + 2, Format + detail::name_end(Format, pos + 2)));
+            }
+            return names;
+        }
+};
+
+template<const char *Format>
+constexpr std::size_t static_message<Format>::field_count;
+
+}
+
+#endif
@@ -0,0 +1,98 @@
+
+#include <boost/test/unit_test.hpp>
+#include "../composer.hpp"
+#include "../static_composer.hpp"
+#include "../buffer_pool.hpp"
+
+#include <new>
+#include <cstdlib>
+
+//the global allocation functions are replaced for the whole test runner,
+//they count the allocations of the calling thread and forward to malloc
+namespace
+{
+    thread_local std::size_t allocations = 0;
+}
+
+void* operator new( std::size_t size )
+{
+    ++allocations;
+    if(void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete( void *p ) noexcept
+{
+    std::free(p);
+}
+
+BOOST_AUTO_TEST_SUITE( allocation_test )
+
+//allocations of rounds calls of f after a first call that warms up
+//the buffers and caches
+template<typename F>
+std::size_t steady_allocations( F f, int rounds = 1000 )
+{
+    f();
+    auto before = allocations;
+    for( int i = 0; i < rounds; ++i )
+        f();
+    return allocations - before;
+}
+
+constexpr char static_record[] = "#2;$(id:%06d);$(name:%-10s);$(value:%x)#3;";
+
+//composing into reused buffers must not allocate once they have grown
+BOOST_AUTO_TEST_CASE( steady_state_composition )
+{
+    composer::sequence_counters counters;
+    composer::context ctx;
+    ctx.counters(&counters);
+
+    const char *formats[] = {
+        "#2;HEADER;VERSION 1.0;STATION 0815;\\$START;#13;#10;STATUS OK;#3;",   //literals
+        "$(id:%06d);$(name:%-10s);$(value:%+.4d);$(code:%X);$(id);$(name:%.3s)",  //fields
+        "#2;$(id:%06d);$(name);#3;$checksum(%02X,crc16modbus)",                //checksum
+        "$now(%Y-%m-%d %H:%M:%S.%L) $(id:%d) $seq(%04d,1,9999)"                 //timestamp
+    };
+    composer::value_ref slots[] = {{"4711", 4}, {"max brause", 10}, {"-42", 3}, {"48879", 5}};
+    char buffer[256];
+    composer::gather_list gl;
+    composer::output_buffer pooled;
+
+    for( auto format: formats )
+    {
+        auto msg = composer::message("alloc", format);
+        auto count = msg.keys().size();
+
+        BOOST_CHECK_EQUAL(0, steady_allocations([&]{ msg.format(slots, count, buffer, sizeof(buffer), &ctx); }));
+        BOOST_CHECK_EQUAL(0, steady_allocations([&]{ msg.format(slots, count, &gl, &ctx); gl.iov(); }));
+        BOOST_CHECK_EQUAL(0, steady_allocations([&]{ msg.format(slots, count, &pooled, &ctx); }));
+    }
+
+    //stencil records with integer fields
+    auto fixed = composer::message("record", "#2;$(id:%06d)|$(value:%04.4d)|$(name:%-10.10s)#3;$checksum(%02X,xor)");
+    BOOST_REQUIRE(fixed.fixed_width());
+    composer::value_ref record_slots[] = {{"4711", 4}, {"-42", 3}, {"max brause", 10}};
+    BOOST_CHECK_EQUAL(0, steady_allocations([&]{ fixed.format_fixed(record_slots, 3, buffer, sizeof(buffer), &ctx); }));
+
+    //recomposition of unchanged values and of values of the same width
+    composer::recomposer unchanged(composer::message("periodic", formats[2]));
+    BOOST_CHECK_EQUAL(0, steady_allocations([&]{ unchanged.format(slots, 4, &ctx); }));
+
+    composer::recomposer same_width(composer::message("periodic", formats[1]));
+    composer::value_ref other[] = {{"4712", 4}, {"max bruise", 10}, {"-43", 3}, {"48878", 5}};
+    bool flip = false;
+    BOOST_CHECK_EQUAL(0, steady_allocations([&]{ same_width.format((flip = !flip) ? other : slots, 4, &ctx); }));
+    BOOST_CHECK(same_width.rendered() > 0); //the fields were rendered again
+
+    //the counter sees the string of the allocating overload
+    auto msg = composer::message("alloc", formats[0]);
+    BOOST_CHECK(steady_allocations([&]{ msg.format(slots, 0, &ctx); }, 10) >= 10);
+
+    typedef composer::static_message<static_record> record;
+    BOOST_CHECK_EQUAL(0, steady_allocations([&]{ record::format(slots, 3, buffer, sizeof(buffer)); }));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
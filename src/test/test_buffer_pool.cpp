@@ -0,0 +1,73 @@
+
+#include <boost/test/unit_test.hpp>
+#include "../composer.hpp"
+#include "../buffer_pool.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <boost/thread/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE( buffer_pool_test )
+
+BOOST_AUTO_TEST_CASE( pooled_buffers )
+{
+    auto msg = composer::message("pooled", "#2;ID$(id:%06d);$(name:%-12s)#3;");
+    composer::value_ref slots[] = {{"4711", 4}, {"max brause", 10}};
+
+    composer::output_buffer out;
+    BOOST_CHECK(out.empty());
+    msg.format(slots, 2, &out);
+    BOOST_CHECK_EQUAL(msg.format(slots, 2), std::string(out.data(), out.size()));
+    BOOST_CHECK(out.capacity() >= msg.size_bound(slots, 2));
+
+    //a reused handle takes the same buffer again, a copy keeps it alive
+    const char *first = out.data();
+    msg.format(slots, 2, &out);
+    BOOST_CHECK(first == out.data());
+    auto copy = out;
+    msg.format(slots, 2, &out);
+    BOOST_CHECK(first != out.data());
+    BOOST_CHECK_EQUAL(msg.format(slots, 2), std::string(copy.data(), copy.size()));
+
+    BOOST_CHECK_THROW(out.resize(out.capacity() + 1), std::string);
+
+    //buffers above the largest class are not pooled
+    std::string big(100000, 'x');
+    composer::value_ref large[] = {{"1", 1}, {big.data(), big.size()}};
+    out.reset();
+    auto pooled = composer::output_buffer::pooled();
+    msg.format(large, 2, &out);
+    BOOST_CHECK_EQUAL(msg.format(large, 2), std::string(out.data(), out.size()));
+    out.reset();
+    BOOST_CHECK_EQUAL(pooled, composer::output_buffer::pooled());
+}
+
+//buffers released on another thread come back to the pool of the thread
+//that took them, a pool outlives its thread until its buffers are back
+BOOST_AUTO_TEST_CASE( release_on_other_threads )
+{
+    std::vector<composer::output_buffer> sent;
+    std::vector<const char*> bytes;
+    for( int i = 0; i < 16; ++i )
+    {
+        sent.push_back(composer::output_buffer(200));
+        bytes.push_back(sent.back().data());
+    }
+
+    auto before = composer::output_buffer::pooled();
+    boost::thread transport([&]{ sent.clear(); });
+    transport.join();
+    BOOST_CHECK_EQUAL(before + 16, composer::output_buffer::pooled());
+    composer::output_buffer again(200);
+    BOOST_CHECK(std::find(bytes.begin(), bytes.end(), again.data()) != bytes.end());
+
+    composer::output_buffer orphan;
+    boost::thread sender([&]{ orphan = composer::output_buffer(1000); orphan.resize(3); });
+    sender.join();
+    BOOST_CHECK_EQUAL(3, orphan.size());
+    orphan.reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+
+#include <boost/test/unit_test.hpp>
+#include "../checksum.hpp"
+
+#include <string>
+#include <cstdlib>
+
+BOOST_AUTO_TEST_SUITE( checksum_tests )
+
+//bitwise reference of a reflected crc
+boost::uint32_t reference_crc( boost::uint32_t poly, boost::uint32_t reg, const std::string &s )
+{
+    for( unsigned char c: s )
+    {
+        reg ^= c;
+        for( int k = 0; k < 8; ++k )
+            reg = (reg & 1) ? (reg >> 1) ^ poly : reg >> 1;
+    }
+    return reg;
+}
+
+BOOST_AUTO_TEST_CASE( check_values )
+{
+    const std::string check("123456789");
+
+    BOOST_CHECK_EQUAL(0xCBF43926u, checksum::compute(checksum::crc32, check.data(), check.size()));
+    BOOST_CHECK_EQUAL(0xBB3Du, checksum::compute(checksum::crc16, check.data(), check.size()));
+    BOOST_CHECK_EQUAL(0x4B37u, checksum::compute(checksum::crc16_modbus, check.data(), check.size()));
+    BOOST_CHECK_EQUAL(0x31u, checksum::compute(checksum::xor8, check.data(), check.size()));
+    BOOST_CHECK_EQUAL(0x23u, checksum::compute(checksum::lrc8, check.data(), check.size()));
+
+    BOOST_CHECK_THROW(checksum::from_name("md5"), std::string);
+    BOOST_CHECK_EQUAL(checksum::crc16_modbus, checksum::from_name("crc16modbus"));
+}
+
+//long runs take the slice-by-8 and carry-less multiply paths, split updates
+//must give the same result as one pass
+BOOST_AUTO_TEST_CASE( long_and_split_runs )
+{
+    std::srand(4711);
+    std::string data;
+    for( int i = 0; i < 5000; ++i )
+        data += static_cast<char>(std::rand() & 0xFF);
+
+    for( std::size_t size: {0, 1, 7, 63, 64, 65, 100, 1000, 4099, 5000} )
+    {
+        auto part = data.substr(0, size);
+        auto crc32 = ~reference_crc(0xEDB88320u, 0xFFFFFFFFu, part);
+        auto crc16 = reference_crc(0xA001u, 0, part);
+
+        BOOST_CHECK_EQUAL(crc32, checksum::compute(checksum::crc32, part.data(), part.size()));
+        BOOST_CHECK_EQUAL(crc16, checksum::compute(checksum::crc16, part.data(), part.size()));
+
+        unsigned char x = 0;
+        for( unsigned char c: part )
+            x ^= c;
+        BOOST_CHECK_EQUAL(x, checksum::compute(checksum::xor8, part.data(), part.size()));
+
+        checksum::state st(checksum::crc32);
+        for( std::size_t pos = 0; pos < size; pos += 97 )
+            st.update(part.data() + pos, std::min<std::size_t>(97, size - pos));
+        BOOST_CHECK_EQUAL(crc32, st.value());
+    }
+}
+
+//appending prepared segments between scanned runs must give the same
+//result as scanning everything, for short and combined segments
+BOOST_AUTO_TEST_CASE( segments )
+{
+    std::srand(815);
+    std::string data;
+    for( int i = 0; i < 3000; ++i )
+        data += static_cast<char>(std::rand() & 0xFF);
+
+    for( auto algo: {checksum::xor8, checksum::lrc8, checksum::crc16, checksum::crc16_modbus, checksum::crc32} )
+    {
+        for( std::size_t size: {0, 5, 31, 32, 33, 200, 1000} )
+        {
+            checksum::segment seg(algo, data.data() + 100, size);
+            checksum::state st(algo);
+            st.update(data.data(), 100);
+            st.append(seg);
+            st.update(data.data() + 100 + size, 50);
+            BOOST_CHECK_EQUAL(checksum::compute(algo, data.data(), 150 + size), st.value());
+
+            checksum::state first(algo);
+            first.append(seg);
+            BOOST_CHECK_EQUAL(checksum::compute(algo, data.data() + 100, size), first.value());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,8 +1,20 @@
 
 #include <boost/test/unit_test.hpp>
 #include "../composer.hpp"
+#include "../checksum.hpp"
+#include "../static_composer.hpp"
+
+#include <cstdio>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <ctime>
 
 #include <boost/unordered_map.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/thread/thread.hpp>
 
 BOOST_AUTO_TEST_SUITE( composer_test )
 
@@ -55,5 +67,508 @@ BOOST_AUTO_TEST_CASE( compose_this_man )
     BOOST_CHECK_EQUAL("$START 103 max brause", result);
 }
 
-BOOST_AUTO_TEST_SUITE_END()
+BOOST_AUTO_TEST_CASE( field_formats )
+{
+    dummy_input ipt("fields");
+    ipt.map_["id"] = "7";
+    ipt.map_["charge"] = "-42";
+    ipt.map_["code"] = "48879";
+    ipt.map_["name"] = "max brause";
+
+    auto cp = composer::message("fields", 
+            "$(id:%2.2d)|$(id:%4d)|$(id:%-4d)|$(charge:%05d)|$(charge:%+.4d)|"
+            "$(code:%X)|$(code:%08x)|$(name:%.3s)|$(name:%-12s)|$(name:%12s)|$(name:<%s>)|"
+            "$(name:%3.3d)|$(id:%5.1f)");
+
+    auto result = cp.format(&ipt);
+    BOOST_CHECK_EQUAL("07|   7|7   |-0042|-0042|BEEF|0000beef|max|max brause  |  max brause|<max brause>|"
+            "max|    7", result); //other specs keep the boost::format behaviour
+
+    //specs boost::format cannot use with one value fail when the message is built
+    BOOST_CHECK_THROW(composer::message("broken", "$(a:%5%)"), std::string);
+    BOOST_CHECK_THROW(composer::message("broken", "$(a:%s %s)"), std::string);
+    BOOST_CHECK_THROW(composer::message("broken", "$(a:%)"), std::string);
+    BOOST_CHECK_THROW(composer::message("broken", "$seq(%s %s)"), std::string);
+}
+
+BOOST_AUTO_TEST_CASE( gather_output )
+{
+    dummy_input ipt("gather");
+    ipt.map_["feld1"] = "103";
+    ipt.map_["name"] = "max brause";
+
+    auto cp = composer::message("gather", "\\$START $(feld1:%3.3d) $(name:%s)");
+    composer::gather_list gl;
+
+    for(int i = 0; i < 2; ++i) //the list is reused
+    {
+        cp.format(&ipt, &gl);
+        auto iov = gl.iov();
+
+        BOOST_CHECK_EQUAL(cp.format(&ipt), gl.str());
+        BOOST_CHECK_EQUAL(gl.str().size(), gl.bytes());
+        BOOST_REQUIRE_EQUAL(4, gl.count());
+        BOOST_CHECK_EQUAL("$START ", std::string((const char*)iov[0].iov_base, iov[0].iov_len));
+        BOOST_CHECK_EQUAL("103", std::string((const char*)iov[1].iov_base, iov[1].iov_len));
+        BOOST_CHECK_EQUAL(" ", std::string((const char*)iov[2].iov_base, iov[2].iov_len));
+        BOOST_CHECK_EQUAL("max brause", std::string((const char*)iov[3].iov_base, iov[3].iov_len));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( slot_binding )
+{
+    auto cp = composer::message("slots", "\\$START $(feld1:%3.3d) $(name:%s)/$(feld1:%04d)");
+
+    BOOST_REQUIRE_EQUAL(2, cp.keys().size());
+    BOOST_CHECK_EQUAL("feld1", cp.keys()[0]);
+    BOOST_CHECK_EQUAL("name", cp.keys()[1]);
+
+    const char raw[] = "12max brause";
+    composer::value_ref slots[] = {{raw, 2}, {raw + 2, 10}};
+    BOOST_CHECK_EQUAL("$START 012 max brause/0012", cp.format(slots, 2));
+
+    BOOST_CHECK_THROW(cp.format(slots, 1), std::string);
+}
+
+BOOST_AUTO_TEST_CASE( checksums )
+{
+    composer::value_ref slots[] = {{"0815", 4}};
+    composer::gather_list gl;
+
+    //legacy form: xor after a leading STX, up to the checksum, as hex text
+    auto cp = composer::message("bcc", "#2;ID$(id:%s)#3;$checksum(%2.2X,int)#13;");
+    unsigned char x = 0;
+    for( char c: std::string("ID0815\x03") )
+        x ^= c;
+    char hex[3];
+    std::snprintf(hex, sizeof(hex), "%02X", x);
+    BOOST_CHECK_EQUAL(std::string("\x02ID0815\x03") + hex + "\r", cp.format(slots, 1));
+    cp.format(slots, 1, &gl);
+    BOOST_CHECK_EQUAL(cp.format(slots, 1), gl.str());
+
+    //crc32 over the region between STX and ETX, ETX included, as raw bytes
+    auto crc = composer::message("crc", "#2;ID$(id)#3;TAIL$checksum(raw,crc32,2,3)");
+    auto result = crc.format(slots, 1);
+    auto value = checksum::compute(checksum::crc32, "ID0815\x03", 7);
+    std::string expected("\x02ID0815\x03TAIL");
+    for( int i = 3; i >= 0; --i )
+        expected += static_cast<char>((value >> (i * 8)) & 0xFF);
+    BOOST_CHECK_EQUAL(expected, result);
+    crc.format(slots, 1, &gl);
+    BOOST_CHECK_EQUAL(result, gl.str());
+
+    //lrc without any skipped byte
+    auto lrc = composer::message("lrc", "AB$checksum(%d,lrc,-)");
+    BOOST_CHECK_EQUAL("AB125", lrc.format(slots, 1));
+
+    //long constant parts are folded into the crc without a scan
+    const std::string head(100, 'H'), tail(40, 'T');
+    auto folded = composer::message("folded", "#2;" + head + "$(id)" + tail + "$checksum(%08X,crc32)");
+    char crc_hex[9];
+    std::snprintf(crc_hex, sizeof(crc_hex), "%08X", checksum::compute(checksum::crc32, (head + "0815" + tail).data(), 144));
+    BOOST_CHECK_EQUAL("\x02" + head + "0815" + tail + crc_hex, folded.format(slots, 1));
+
+    BOOST_CHECK_THROW(composer::message("twice", "$checksum(%d,lrc)$checksum(%d,lrc)"), std::string);
+    BOOST_CHECK_THROW(composer::message("bad", "$checksum(%d,md5)"), std::string);
+}
+
+BOOST_AUTO_TEST_CASE( timestamps )
+{
+    const composer::value_ref *no_fields = 0;
+    auto year = composer::message("year", "Y$now(%Y)");
+    std::time_t t = std::time(0);
+    std::tm local;
+    localtime_r(&t, &local);
+    char expected[8];
+    std::strftime(expected, sizeof(expected), "%Y", &local);
+    BOOST_CHECK_EQUAL(std::string("Y") + expected, year.format(no_fields, 0));
+
+    //millisecond part, the percent sign escapes itself
+    auto ms = composer::message("ms", "$now(%S.%L %%L)");
+    auto result = ms.format(no_fields, 0);
+    BOOST_REQUIRE_EQUAL(9, result.size());
+    BOOST_CHECK_EQUAL('.', result[2]);
+    BOOST_CHECK_EQUAL(" %L", result.substr(6));
+    for( auto pos: {0, 1, 3, 4, 5} )
+        BOOST_CHECK(std::isdigit(result[pos]));
+}
+
+BOOST_AUTO_TEST_CASE( constant_folding )
+{
+    composer::value_ref slots[] = {{"42", 2}};
+    composer::gather_list gl;
+
+    //escapes, ascii codes and repeat become one literal block on each side
+    auto cp = composer::message("folded", "#2;A\\$$repeat(-,3)#32;$(n:%04d)$repeat(32,2)\\##3;");
+    BOOST_CHECK_EQUAL("\x02" "A$--- 0042  #\x03", cp.format(slots, 1));
+
+    cp.format(slots, 1, &gl);
+    BOOST_CHECK_EQUAL(3, gl.count());
+    BOOST_CHECK_EQUAL(cp.format(slots, 1), gl.str());
+
+    //the checksum region still splits a folded block at STX
+    auto sum = composer::message("sum", "#2;AB$repeat(C,2)$checksum(%02X,xor)");
+    BOOST_CHECK_EQUAL("\x02" "ABCC03", sum.format(slots, 1));
+}
+
+BOOST_AUTO_TEST_CASE( size_bound )
+{
+    composer::value_ref slots[] = {{"-17", 3}, {"max brause", 10}};
+    auto cp = composer::message("bound",
+            "#2;$(n:%+08d) $(s:%-12.4s)$(n:%x)$(s:[%5.1f])$repeat(*,3)$checksum(%04X,crc16)#13;");
+
+    auto expected = cp.format(slots, 2);
+    auto bound = cp.size_bound(slots, 2);
+    BOOST_CHECK_GE(bound, expected.size());
+
+    char buffer[256];
+    BOOST_REQUIRE_LE(bound, sizeof(buffer));
+    auto size = cp.format(slots, 2, buffer, sizeof(buffer));
+    BOOST_CHECK_EQUAL(expected, std::string(buffer, size));
+
+    BOOST_CHECK_THROW(cp.format(slots, 2, buffer, expected.size() - 1), std::string);
+    BOOST_CHECK_THROW(cp.size_bound(slots, 1), std::string);
+
+    //integer fields count the digits of their values, a buffer that holds
+    //the record is enough
+    auto record = composer::message("record", "$(a:%06d)|$(b:%06d)|$(c:%06x)|$(s:%-5.3s)");
+    composer::value_ref numbers[] = {{"17", 2}, {"-4711", 5}, {"1234567", 7}, {"max brause", 10}};
+    BOOST_CHECK_EQUAL("000017|-04711|12d687|max  ", record.format(numbers, 4));
+    BOOST_CHECK_EQUAL(26, record.size_bound(numbers, 4));
+    BOOST_CHECK_EQUAL(26, record.format(numbers, 4, buffer, 26));
+}
+
+BOOST_AUTO_TEST_CASE( batch )
+{
+    auto cp = composer::message("batch", "#2;DEV$(id:%05d) $(text:%s)#3;$checksum(%02X,xor)");
+
+    std::vector<std::string> values;
+    for( int i = 0; i < 1000; ++i )
+    {
+        values.push_back(boost::lexical_cast<std::string>(i * 7));
+        values.push_back(std::string(i % 13, 'a' + i % 26));
+    }
+    std::vector<composer::value_ref> rows;
+    for( const auto &v: values )
+        rows.push_back(composer::value_ref{v.data(), v.size()});
+
+    std::string expected;
+    for( std::size_t i = 0; i < 1000; ++i )
+        expected += cp.format(&rows[2 * i], 2);
+
+    boost::asio::thread_pool pool(4);
+    for( auto *p: {(boost::asio::thread_pool*)0, &pool} )
+    {
+        std::vector<char> buffer(cp.batch_bound(rows.data(), 1000));
+        std::vector<std::size_t> offsets(1001);
+        auto size = cp.format_batch(rows.data(), 1000, buffer.data(), buffer.size(), offsets.data(), p);
+
+        BOOST_CHECK_EQUAL(expected, std::string(buffer.data(), size));
+        BOOST_CHECK_EQUAL(size, offsets[1000]);
+        BOOST_CHECK_EQUAL(cp.format(&rows[2 * 500], 2), 
+                std::string(buffer.data() + offsets[500], offsets[501] - offsets[500]));
+        BOOST_CHECK_THROW(cp.format_batch(rows.data(), 1000, buffer.data(), size - 1, offsets.data(), p), std::string);
+    }
+
+    //errors of a chunk reach the caller
+    auto counted = composer::message("counted", "$(id:%s)$seq(%d)");
+    std::vector<char> buffer(counted.batch_bound(rows.data(), 1000));
+    std::vector<std::size_t> offsets(1001);
+    BOOST_CHECK_THROW(counted.format_batch(rows.data(), 1000, buffer.data(), buffer.size(), offsets.data(), &pool), 
+            std::string);
+    pool.join();
+}
+
+BOOST_AUTO_TEST_CASE( stencil )
+{
+    auto cp = composer::message("record", "#2;ID$(id:%05d)|$(name:%-8.8s)$repeat(.,3)#3;$checksum(%02X,xor)#13;");
+    BOOST_REQUIRE(cp.fixed_width());
+    BOOST_CHECK_EQUAL(24, cp.record_size());
+
+    char buffer[64];
+    for( auto name: {"max", "brausepulver", ""} )
+    {
+        composer::value_ref slots[] = {{"42", 2}, {name, std::strlen(name)}};
+        auto size = cp.format_fixed(slots, 2, buffer, sizeof(buffer));
+        BOOST_CHECK_EQUAL(cp.format(slots, 2), std::string(buffer, size));
+    }
 
+    //signs, zeros and text in an integer field
+    for( auto id: {"-42", "+0", "0", "abc", "99999", "-9999"} )
+    {
+        composer::value_ref slots[] = {{id, std::strlen(id)}, {"max", 3}};
+        auto size = cp.format_fixed(slots, 2, buffer, sizeof(buffer));
+        BOOST_CHECK_EQUAL(cp.format(slots, 2), std::string(buffer, size));
+    }
+
+    //a value wider than its field fails the record
+    composer::value_ref wide[] = {{"1234567", 7}, {"max", 3}};
+    BOOST_CHECK_EQUAL(0, cp.format_fixed(wide, 2, buffer, sizeof(buffer)));
+    composer::value_ref wide_negative[] = {{"-12345", 6}, {"max", 3}};
+    BOOST_CHECK_EQUAL(0, cp.format_fixed(wide_negative, 2, buffer, sizeof(buffer)));
+    composer::value_ref wide_text[] = {{"abcdef", 6}, {"max", 3}};
+    BOOST_CHECK_EQUAL(0, cp.format_fixed(wide_text, 2, buffer, sizeof(buffer)));
+    BOOST_CHECK_THROW(cp.format_fixed(wide, 2, buffer, 10), std::string);
+
+    auto free_width = composer::message("free", "ID$(id:%d)");
+    BOOST_CHECK(!free_width.fixed_width());
+    BOOST_CHECK_THROW(free_width.format_fixed(wide, 1, buffer, sizeof(buffer)), std::string);
+}
+
+//one compiled message serves several threads, each with the context of
+//its thread or with its own one
+BOOST_AUTO_TEST_CASE( shared_message )
+{
+    const composer::message cp("shared", "#2;$now(%Y)|$(id:%06d)|$(name:%-10s)#3;$checksum(%04X,crc16)");
+
+    std::vector<std::string> ids, expected;
+    for( int i = 0; i < 200; ++i )
+        ids.push_back(boost::lexical_cast<std::string>(i * 31));
+    for( const auto &id: ids )
+    {
+        composer::value_ref slots[] = {{id.data(), id.size()}, {"worker", 6}};
+        expected.push_back(cp.format(slots, 2));
+    }
+
+    std::vector<int> mismatches(4, 0);
+    boost::thread_group workers;
+    for( int t = 0; t < 4; ++t )
+    {
+        workers.create_thread([&, t]() {
+            composer::context own;
+            for( int round = 0; round < 50; ++round )
+            {
+                for( std::size_t i = 0; i < ids.size(); ++i )
+                {
+                    composer::value_ref slots[] = {{ids[i].data(), ids[i].size()}, {"worker", 6}};
+                    if(cp.format(slots, 2, t % 2 ? &own : 0) != expected[i])
+                        ++mismatches[t];
+                }
+            }
+        });
+    }
+    workers.join_all();
+
+    for( int m: mismatches )
+        BOOST_CHECK_EQUAL(0, m);
+}
+
+BOOST_AUTO_TEST_CASE( sequence_numbers )
+{
+    composer::sequence_counters device;
+    composer::context ctx;
+    ctx.counters(&device);
+    const composer::value_ref *no_fields = 0;
+
+    auto cp = composer::message("seq", "T$seq(%04d,1,3,telegram)|$seq(%02X,0,255,frame)");
+    BOOST_CHECK_EQUAL("T0001|00", cp.format(no_fields, 0, &ctx));
+    BOOST_CHECK_EQUAL("T0002|01", cp.format(no_fields, 0, &ctx));
+    BOOST_CHECK_EQUAL("T0003|02", cp.format(no_fields, 0, &ctx));
+    BOOST_CHECK_EQUAL("T0001|03", cp.format(no_fields, 0, &ctx));
+
+    //the stencil writes the number over its placeholder
+    BOOST_REQUIRE(cp.fixed_width());
+    char buffer[16];
+    BOOST_CHECK_EQUAL("T0002|04", std::string(buffer, cp.format_fixed(no_fields, 0, buffer, sizeof(buffer), &ctx)));
+
+    device.set(composer::sequence_counters::slot("frame"), 255);
+    BOOST_CHECK_EQUAL("T0003|FF", cp.format(no_fields, 0, &ctx));
+    BOOST_CHECK_EQUAL("T0001|00", cp.format(no_fields, 0, &ctx));
+
+    composer::context without;
+    BOOST_CHECK_THROW(cp.format(no_fields, 0, &without), std::string);
+    BOOST_CHECK_THROW(composer::message("bad", "$seq(%d,5,4)"), std::string);
+
+    //a range of one number and the full 64 bit range
+    auto single = composer::message("single", "$seq(%d,7,7,single)");
+    BOOST_CHECK_EQUAL("7", single.format(no_fields, 0, &ctx));
+    BOOST_CHECK_EQUAL("7", single.format(no_fields, 0, &ctx));
+    auto full = composer::message("full", "$seq(%d,0,18446744073709551615,full)");
+    device.set(composer::sequence_counters::slot("full"), 18446744073709551615ull);
+    BOOST_CHECK_EQUAL("18446744073709551615", full.format(no_fields, 0, &ctx));
+    BOOST_CHECK_EQUAL("0", full.format(no_fields, 0, &ctx));
+    BOOST_CHECK(full.size_bound(no_fields, 0) >= 20);
+
+    //senders on several threads never get the same number
+    auto numbers = composer::message("numbers", "$seq(%d)");
+    std::vector<std::vector<std::string> > drawn(4);
+    boost::thread_group senders;
+    for( int t = 0; t < 4; ++t )
+    {
+        senders.create_thread([&, t]() {
+            composer::context own;
+            own.counters(&device);
+            for( int i = 0; i < 5000; ++i )
+                drawn[t].push_back(numbers.format(no_fields, 0, &own));
+        });
+    }
+    senders.join_all();
+
+    std::vector<std::string> all;
+    for( const auto &d: drawn )
+        all.insert(all.end(), d.begin(), d.end());
+    std::sort(all.begin(), all.end());
+    BOOST_CHECK_EQUAL(20000, all.size());
+    BOOST_CHECK(std::adjacent_find(all.begin(), all.end()) == all.end());
+}
+
+BOOST_AUTO_TEST_CASE( recomposition )
+{
+    composer::sequence_counters device, reference;
+    composer::context ctx, ref_ctx;
+    ctx.counters(&device);
+    ref_ctx.counters(&reference);
+
+    auto cp = composer::message("status", "#2;ST$seq(%03d,0,999)|$(temp:%5s)|$(state:%s)|" 
+            + std::string(60, '-') + "#3;$checksum(%04X,crc16modbus)#13;");
+    composer::recomposer last(cp);
+
+    composer::value_ref slots[] = {{"21.5", 4}, {"idle", 4}};
+    BOOST_CHECK_EQUAL(cp.format(slots, 2, &ref_ctx), last.format(slots, 2, &ctx));
+
+    //nothing changed: only the sequence number and the checksum
+    BOOST_CHECK_EQUAL(cp.format(slots, 2, &ref_ctx), last.format(slots, 2, &ctx));
+    BOOST_CHECK_EQUAL(2, last.rendered());
+
+    //same width, patched in place
+    slots[0] = composer::value_ref{"22.0", 4};
+    BOOST_CHECK_EQUAL(cp.format(slots, 2, &ref_ctx), last.format(slots, 2, &ctx));
+    BOOST_CHECK_EQUAL(3, last.rendered());
+
+    //another width moves the rest of the output
+    slots[1] = composer::value_ref{"running", 7};
+    BOOST_CHECK_EQUAL(cp.format(slots, 2, &ref_ctx), last.format(slots, 2, &ctx));
+    slots[1] = composer::value_ref{"off", 3};
+    BOOST_CHECK_EQUAL(cp.format(slots, 2, &ref_ctx), last.format(slots, 2, &ctx));
+
+    last.reset();
+    BOOST_CHECK_EQUAL(cp.format(slots, 2, &ref_ctx), last.format(slots, 2, &ctx));
+    BOOST_CHECK_THROW(last.format(slots, 1, &ctx), std::string);
+}
+
+BOOST_AUTO_TEST_CASE( save_and_load )
+{
+    composer::sequence_counters device, reference;
+    composer::context ctx, ref_ctx;
+    ctx.counters(&device);
+    ref_ctx.counters(&reference);
+
+    std::vector<composer::message> originals = {
+        composer::message("plain", "ID$(id:%05d) $(name:%-6.3s)$repeat(*,4)"),
+        composer::message("sum", "#2;$(id)|$now(%Y)|$seq(%03d,1,999)#3;$checksum(%02X,xor,2,3)#13;"),
+        composer::message("raw", "#2;" + std::string(50, 'x') + "$(name:[%5.1f])$checksum(raw,crc32)")
+    };
+
+    std::stringstream file;
+    for( const auto &m: originals )
+        m.save(file);
+
+    composer::value_ref slots[] = {{"42", 2}, {"max brause", 10}};
+    for( const auto &m: originals )
+    {
+        auto loaded = composer::message::load(file);
+        BOOST_CHECK(loaded.keys() == m.keys());
+        BOOST_CHECK_EQUAL(m.format(slots, 2, &ref_ctx), loaded.format(slots, 2, &ctx));
+        BOOST_CHECK_EQUAL(m.fixed_width(), loaded.fixed_width());
+    }
+    BOOST_CHECK_THROW(composer::message::load(file), std::string);
+
+    //a truncated or damaged program is refused
+    std::stringstream one;
+    originals[1].save(one);
+    auto bytes = one.str();
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 3));
+    BOOST_CHECK_THROW(composer::message::load(truncated), std::string);
+    bytes[4] = 9;
+    std::stringstream other_version(bytes);
+    BOOST_CHECK_THROW(composer::message::load(other_version), std::string);
+
+    //huge lengths and counts of a short stream are not allocated
+    std::string head("CMPS\x01\0\0\0", 8);
+    std::stringstream long_name(head + "\xF0\xFF\xFF\xFFname");
+    BOOST_CHECK_THROW(composer::message::load(long_name), std::string);
+    std::stringstream many_keys(head + std::string("\0\0\0\0\xF0\xFF\xFF\xFF", 8));
+    BOOST_CHECK_THROW(composer::message::load(many_keys), std::string);
+    std::stringstream many_ops(head + std::string(12, '\0') + "\xF0\xFF\xFF\xFF");
+    BOOST_CHECK_THROW(composer::message::load(many_ops), std::string);
+
+    //a repeat op with a huge count is refused before it is expanded
+    std::stringstream huge_repeat(head + std::string(12, '\0') + std::string("\x01\0\0\0\x02\0\0\0x\0\0\0\xFF\xFF\xFF\xFF", 16) + std::string(16, '\0'));
+    BOOST_CHECK_THROW(composer::message::load(huge_repeat), std::string);
+}
+
+BOOST_AUTO_TEST_CASE( binary_fields )
+{
+    auto cp = composer::message("binary", 
+            "#2;#255;$(a:u16be)$(a:u16le)$(b:i8)$(c:i32be)$(d:bcd3)$(e:lp8)$(e:lp16le)$(f:u64be)");
+    composer::value_ref slots[] = {{"4660", 4}, {"-2", 2}, {"-16777216", 9}, {"12345", 5}, 
+        {"ok", 2}, {"18446744073709551615", 20}};
+
+    const char expected[] = "\x02\xFF" "\x12\x34" "\x34\x12" "\xFE" "\xFF\x00\x00\x00" "\x01\x23\x45"
+        "\x02ok" "\x02\x00ok" "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF";
+    BOOST_CHECK_EQUAL(std::string(expected, sizeof(expected) - 1), cp.format(slots, 6));
+
+    //out of range values are refused
+    composer::value_ref too_big[] = {{"65536", 5}, {"0", 1}, {"0", 1}, {"0", 1}, {"", 0}, {"18446744073709551616", 20}};
+    BOOST_CHECK_THROW(cp.format(too_big, 6), std::string);
+    auto unsigned_only = composer::message("u8", "$(v:u8)");
+    composer::value_ref negative[] = {{"-1", 2}};
+    BOOST_CHECK_THROW(unsigned_only.format(negative, 1), std::string);
+
+    //fixed size encodings keep a record fixed-width, a raw crc can be packed little endian
+    auto record = composer::message("record", "$(a:u32le)$(d:bcd2)$checksum(u16le,crc16modbus,-)");
+    BOOST_REQUIRE(record.fixed_width());
+    composer::value_ref values[] = {{"1", 1}, {"42", 2}};
+    char buffer[16];
+    auto size = record.format_fixed(values, 2, buffer, sizeof(buffer));
+    BOOST_CHECK_EQUAL(record.format(values, 2), std::string(buffer, size));
+    auto crc = checksum::compute(checksum::crc16_modbus, "\x01\x00\x00\x00\x00\x42", 6);
+    BOOST_CHECK_EQUAL(char(crc & 0xFF), buffer[6]);
+    BOOST_CHECK_EQUAL(char(crc >> 8), buffer[7]);
+}
+
+//formats of static messages are char arrays with linkage
+constexpr char static_record[] = "\\$START $(feld1:%3.3d) $(name:%s)/$(feld1:%04d)#13;#10;";
+constexpr char static_fields[] = 
+    "$(id:%2.2d)|$(id:%4d)|$(id:%-4d)|$(charge:%05d)|$(charge:%+.4d)|$(code:%X)|$(code:%08x)|"
+    "$(name:%.3s)|$(name:%-12s)|$(name:%12s)|$(name:<%s>)|$(name:%3.3d)|$(id:% d)|$(id:100%% %ld%%)|"
+    "$(name)$repeat(=,5)$repeat(42,3)\\\nX\\#";
+
+//malformed formats are refused by the compiler
+static_assert(!composer::detail::well_formed("$(open", 0), "unterminated field");
+static_assert(!composer::detail::well_formed("#12", 0), "unterminated ascii code");
+static_assert(!composer::detail::well_formed("$repeat(a,3", 0), "unterminated function");
+static_assert(composer::static_message<static_fields>::field_count == 4, "distinct fields");
+
+BOOST_AUTO_TEST_CASE( static_messages )
+{
+    typedef composer::static_message<static_record> record;
+    BOOST_CHECK(record::keys() == composer::message("record", static_record).keys());
+
+    const char raw[] = "12max brause";
+    composer::value_ref slots[] = {{raw, 2}, {raw + 2, 10}};
+    BOOST_CHECK_EQUAL("$START 012 max brause/0012\r\n", record::format(slots, 2));
+    BOOST_CHECK_THROW(record::format(slots, 1), std::string);
+
+    char small[8];
+    BOOST_CHECK_THROW(record::format(slots, 2, small, sizeof(small)), std::string);
+
+    typedef composer::static_message<static_fields> fields;
+    auto dynamic = composer::message("fields", static_fields);
+    BOOST_REQUIRE(fields::keys() == dynamic.keys());
+
+    composer::value_ref values[][4] = {
+        {{"7", 1}, {"-42", 3}, {"48879", 5}, {"max brause", 10}},
+        {{"", 0}, {"+0", 2}, {"12a", 3}, {"x", 1}},
+        {{"-123456789012345678", 19}, {"1234567890123456789", 19}, {"0", 1}, {"", 0}}};
+    for( auto &row: values )
+    {
+        char buffer[512];
+        auto size = fields::format(row, 4, buffer, sizeof(buffer));
+        BOOST_CHECK_EQUAL(dynamic.format(row, 4), std::string(buffer, size));
+        BOOST_CHECK_EQUAL(size, fields::size_bound(row, 4));
+        BOOST_CHECK_EQUAL(dynamic.size_bound(row, 4), fields::size_bound(row, 4));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+
+#include <boost/test/unit_test.hpp>
+#include "../registry.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+BOOST_AUTO_TEST_SUITE( registry_tests )
+
+BOOST_AUTO_TEST_CASE( perfect_hash )
+{
+    std::vector<composer::message> messages;
+    for( int i = 0; i < 500; ++i )
+    {
+        auto name = "msg" + boost::lexical_cast<std::string>(i * 7919);
+        messages.push_back(composer::message(name, "#2;" + name + "$(value)#3;"));
+    }
+    composer::registry reg(messages);
+    BOOST_REQUIRE_EQUAL(500, reg.size());
+
+    //ids are dense and follow the definition
+    for( std::size_t i = 0; i < messages.size(); ++i )
+    {
+        BOOST_CHECK_EQUAL(i, reg.id(messages[i].name()));
+        BOOST_CHECK_EQUAL(messages[i].name(), reg[i].name());
+    }
+
+    BOOST_CHECK_EQUAL(composer::registry::npos, reg.id("msg1"));
+    BOOST_CHECK_EQUAL(composer::registry::npos, reg.id(""));
+    BOOST_CHECK_THROW(reg.get("unknown"), std::string);
+    BOOST_CHECK_THROW(reg.at(500), std::string);
+
+    composer::registry empty((std::vector<composer::message>()));
+    BOOST_CHECK_EQUAL(composer::registry::npos, empty.id("msg0"));
+
+    messages.push_back(composer::message("msg0", "again"));
+    BOOST_CHECK_THROW(composer::registry dup(messages), std::string);
+}
+
+BOOST_AUTO_TEST_CASE( protocol_file )
+{
+    namespace fs = boost::filesystem;
+    auto path = fs::temp_directory_path() / fs::unique_path("protocol-%%%%%%.xml");
+    {
+        std::ofstream out(path.string().c_str());
+        out << "<protocol>\n"
+            << "  <message name=\"status\" format=\"#2;ST$(state:%s)#3;\"/>\n"
+            << "  <message name=\"print\" format=\"PR$(x:%04d)$(y:%04d)\"/>\n"
+            << "</protocol>\n";
+    }
+
+    auto reg = composer::registry::load(path);
+    fs::remove(path);
+
+    BOOST_REQUIRE_EQUAL(2, reg.size());
+    BOOST_CHECK_EQUAL(1, reg.id("print"));
+    composer::value_ref slots[] = {{"12", 2}, {"7", 1}};
+    BOOST_CHECK_EQUAL("PR00120007", reg.get("print").format(slots, 2));
+
+    BOOST_CHECK_THROW(composer::registry::load(path), std::string);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include <boost/unordered_map.hpp>
 #include <string>
+#include <vector>
 
 BOOST_AUTO_TEST_SUITE( scanner_tests )
 
@@ -95,4 +96,153 @@ BOOST_AUTO_TEST_CASE( message_parsing )
     BOOST_CHECK_EQUAL("BEGIN_TEXT", rs.items_["ts3"]);
 }
 
+//REQUIREMENT 004
+//guard rules assert a literal at a fixed offset and run before any other rule
+
+BOOST_AUTO_TEST_CASE( guard_rule )
+{
+    test_result_handler rs;
+
+    auto guard = parsers::parser_rule("type", 2, std::string("GI|"));
+    BOOST_CHECK_EQUAL(true, guard.parse("@@GI|testentry@@", &rs));
+    BOOST_CHECK_EQUAL(false, guard.parse("@@GX|testentry@@", &rs));
+    BOOST_CHECK_EQUAL(true, guard.parse("@@GI|", &rs)); //frame ends inside the word
+    BOOST_CHECK_EQUAL(false, guard.parse("@@GI", &rs));
+    BOOST_CHECK_EQUAL(0, rs.items_.size());
+
+    auto long_guard = parsers::parser_rule("type", 1, std::string("0123456789ABCDEF"));
+    BOOST_CHECK_EQUAL(true, long_guard.parse("#0123456789ABCDEF", &rs));
+    BOOST_CHECK_EQUAL(false, long_guard.parse("#0123456789ABCDEX", &rs));
+
+    parsers::message_parser_factory fc;
+    fc.identity("guarded");
+    fc.items( {{"text", "GI|", "@@"}, {"type", 2, std::string("GI|")}} );
+    auto parser = parsers::message_parser(fc);
+
+    BOOST_CHECK_EQUAL(false, parser.parse("GI|testentry@@", &rs));
+    BOOST_CHECK_EQUAL(0, rs.items_.count("text"));
+    BOOST_CHECK_EQUAL(true, parser.parse("@@GI|testentry@@", &rs));
+    BOOST_CHECK_EQUAL("testentry", rs.items_["text"]);
+}
+
+//REQUIREMENT 005
+//repeating groups report each element with its index
+
+struct group_result_handler : public test_result_handler
+{
+    std::vector<std::pair<std::size_t, std::string> > elements_;
+
+    virtual bool element_parsed( const std::string & /*name*/, std::size_t index, const std::string &value )
+    {
+        elements_.push_back(std::make_pair(index, value));
+        return true;
+    }
+};
+
+BOOST_AUTO_TEST_CASE( group_rule )
+{
+    group_result_handler rs;
+
+    parsers::message_parser_factory fc;
+    fc.identity("inventory");
+    fc.items( {{"store", 0, 3}, {"items", "<", ">", ";"}} );
+    auto parser = parsers::message_parser(fc);
+
+    BOOST_CHECK_EQUAL(true, parser.parse("001<A1;B22;;C3;>", &rs));
+    BOOST_REQUIRE_EQUAL(4, rs.elements_.size());
+    BOOST_CHECK_EQUAL(0, rs.elements_[0].first);
+    BOOST_CHECK_EQUAL("A1", rs.elements_[0].second);
+    BOOST_CHECK_EQUAL("B22", rs.elements_[1].second);
+    BOOST_CHECK_EQUAL("", rs.elements_[2].second);
+    BOOST_CHECK_EQUAL(3, rs.elements_[3].first);
+    BOOST_CHECK_EQUAL("C3", rs.elements_[3].second);
+    BOOST_CHECK_EQUAL("001", rs.items_["store"]);
+
+    rs.elements_.clear();
+    BOOST_CHECK_EQUAL(true, parser.parse("002<>", &rs));
+    BOOST_CHECK_EQUAL(0, rs.elements_.size());
+    BOOST_CHECK_EQUAL(false, parser.parse("003<A1", &rs));
+
+    std::string batch("004<");
+    for(std::size_t i = 0; i < 5000; ++i)
+        batch += "item;";
+    batch += ">";
+    rs.elements_.clear();
+    BOOST_CHECK_EQUAL(true, parser.parse(batch, &rs));
+    BOOST_CHECK_EQUAL(5000, rs.elements_.size());
+    BOOST_CHECK_EQUAL(4999, rs.elements_.back().first);
+}
+
+//REQUIREMENT 006
+//the scanner proves at construction that its parsers exclude each other
+
+parsers::message_parser make_parser( const std::string &name, 
+        const std::vector<parsers::parser_rule> &rules )
+{
+    parsers::message_parser_factory fc;
+    fc.identity(name);
+    fc.items(rules);
+    return parsers::message_parser(fc);
+}
+
+BOOST_AUTO_TEST_CASE( exclusive_parsers )
+{
+    auto gi = make_parser("gi", {{"type", 2, std::string("GI|")}, {"text", "|", "@@"}});
+    auto go = make_parser("go", {{"type", 2, std::string("GO|")}, {"text", "|", "@@"}});
+    auto shrt = make_parser("short", {{"len", parsers::frame_length{0, 4}}, {"v", 0, 2}});
+    auto lng = make_parser("long", {{"len", parsers::frame_length{10, 20}}, 
+            {"type", 2, std::string("23")}, {"v", 0, 8}});
+    auto any = make_parser("any", {{"text", "|", "@@"}});
+
+    BOOST_CHECK_EQUAL(true, gi.exclusive_of(go));
+    BOOST_CHECK_EQUAL(true, shrt.exclusive_of(lng));
+    BOOST_CHECK_EQUAL(false, gi.exclusive_of(any));
+
+    parsers::scanner_factory sf;
+    sf.identity("protocol");
+    sf.items({gi, go, shrt, lng});
+    auto sc = parsers::scanner(sf, true);
+    BOOST_CHECK_EQUAL(0, sc.ambiguities().size());
+
+    test_result_handler rs;
+    BOOST_CHECK_EQUAL(true, sc.parse("@@GO|entry@@", &rs));
+    BOOST_CHECK_EQUAL("go", rs.name_);
+    BOOST_CHECK_EQUAL(true, sc.parse("0123456789", &rs));
+    BOOST_CHECK_EQUAL("long", rs.name_);
+    BOOST_CHECK_EQUAL(false, sc.parse("0123456", &rs));
+
+    sf.items({gi, any, go});
+    auto flagged = parsers::scanner(sf);
+    BOOST_REQUIRE_EQUAL(2, flagged.ambiguities().size());
+    BOOST_CHECK_EQUAL("gi", flagged.ambiguities()[0].first);
+    BOOST_CHECK_EQUAL("any", flagged.ambiguities()[0].second);
+
+    BOOST_CHECK_THROW(parsers::scanner(sf, true), std::string);
+}
+
+//REQUIREMENT 007
+//frames are parsed in place from a raw range of a receive buffer
+
+BOOST_AUTO_TEST_CASE( span_input )
+{
+    test_result_handler rs;
+    const char buffer[] = "xx001 002 12345@@BEGIN_TEXT|!!NEXT_TEXT<<@@LATER|";
+    const char *frame = buffer + 2;
+    const std::size_t size = 39; //ends behind "<<"
+
+    parsers::message_parser_factory fc;
+    fc.identity("testparser");
+    fc.items( {{"ts1", 0, 3}, {"ts3", "@@", "|"}, {"ts4", "!!", "<<"}} );
+    auto parser = parsers::message_parser(fc);
+
+    BOOST_CHECK_EQUAL(true, parser.parse(frame, size, &rs));
+    BOOST_CHECK_EQUAL("001", rs.items_["ts1"]);
+    BOOST_CHECK_EQUAL("BEGIN_TEXT", rs.items_["ts3"]);
+    BOOST_CHECK_EQUAL("NEXT_TEXT", rs.items_["ts4"]);
+
+    //the end delimiter is cut off, nothing behind the range may be read
+    BOOST_CHECK_EQUAL(false, parser.parse(frame, size - 1, &rs));
+    BOOST_CHECK_EQUAL(false, parsers::parser_rule("ts5", "@@L", "|").parse(frame, size, &rs));
+}
+
 BOOST_AUTO_TEST_SUITE_END()